@@ -0,0 +1,407 @@
+//////////////////////////////////////////////////////////////////////
+//
+// bench-assets.cpp
+//
+// The demo.cpp workload, scaled up: levels made of many asset files
+// of varied sizes, loaded into an allocator as a LevelData object plus
+// one Malloc'd buffer per file, then unloaded and reloaded in the
+// patterns a game streams them in.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/bench-assets.cpp -o bench-assets -pthread
+//
+// USAGE:
+//   bench-assets [--dir path] [--assets n] [--levels n] [--filter text]
+//                [--trials n] [--json results.json]
+//
+//   --dir     where to write the generated asset files (default: a new
+//             directory under $TMPDIR, removed afterwards)
+//   --assets  asset files to generate, 1 KiB to 1 MiB (default 400)
+//   --levels  level loads per pattern (default 200)
+//
+// BENCHMARKS (assets/<pattern>/<reader>):
+//   sequential  load a level, unload it, load the next.
+//   window      keep the last 4 levels loaded; each new load unloads
+//               the oldest. Open world streaming.
+//   random      keep 4 levels loaded; each new load unloads a random
+//               one. Menus, fast travel, respawns.
+//
+//   stdio       demo.cpp's fopen, ftell, Malloc(size+1), fread.
+//   loadfile    xo::LoadFileInto: fstat, Malloc, pread into the block.
+//
+// BENCHMARKS (assets/startup/<reader>):
+//   Every asset file loaded once, then all freed: a startup. Besides
+//   stdio and loadfile, the readers are xo::AsyncLoader through
+//   io_uring (async-uring, skipped where the kernel refuses) and
+//   through its thread pool (async-threads). The files are in the page
+//   cache after generation, so this measures per file overhead rather
+//   than the disk.
+//
+//   One op is one asset file loaded. Each result also reports
+//   mib_per_s (file bytes loaded per second of load time), peak_mib
+//   (peak resident growth of the process), frag_max (worst
+//   BlockStats::Fragmentation() after any load, arena only) and
+//   failed (loads that didn't fit).
+//
+//////////////////////////////////////////////////////////////////////
+#include "xo-bench.h"
+#include "../xo-alloc-io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using xo::bench::Rng;
+using xo::bench::Suite;
+
+namespace {
+
+static const uint32_t LevelsResident = 4;
+
+struct Asset {
+  char* FileContents;
+  size_t Size;
+};
+
+// As in demo.cpp, plus the assets that make up the level.
+struct LevelData {
+  LevelData(std::string name, uint32_t assets)
+    : LevelName(name)
+    , Assets(nullptr)
+    , AssetCount(assets) {
+  }
+
+  std::string LevelName;
+  Asset* Assets;
+  uint32_t AssetCount;
+};
+
+struct Library {
+  std::string Dir;
+  std::vector<std::string> Files;
+  std::vector<std::vector<uint32_t> > Levels; // asset indices per level
+};
+
+bool Generate(Library* lib, uint32_t assets, uint32_t levels) {
+  Rng rng(5);
+  std::vector<char> bytes(1u << 20);
+  for(char& c : bytes) {
+    c = static_cast<char>(rng.Next());
+  }
+  for(uint32_t i = 0; i < assets; ++i) {
+    // log distributed: as many 1-2 KiB files as 512 KiB-1 MiB ones.
+    uint32_t lo = 1024u << rng.Range(0, 9);
+    uint32_t size = rng.Range(lo, lo*2-1);
+    std::string path = lib->Dir + "/asset" + std::to_string(i) + ".bin";
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f) {
+      return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, size, f) == size;
+    if(fclose(f) != 0 || !ok) {
+      return false;
+    }
+    lib->Files.push_back(path);
+  }
+  for(uint32_t l = 0; l < levels; ++l) {
+    std::vector<uint32_t> level(rng.Range(10, 40));
+    for(uint32_t& a : level) {
+      a = rng.Range(0, assets-1);
+    }
+    lib->Levels.push_back(level);
+  }
+  return true;
+}
+
+void Cleanup(const Library& lib) {
+  for(const std::string& f : lib.Files) {
+    remove(f.c_str());
+  }
+}
+
+////////////////////////////////////////////////////////////////////// Loading
+
+template<typename API>
+struct Loader {
+  API& Api;
+  uint64_t Bytes;
+  uint64_t Files;
+  uint64_t Failed;
+
+  bool Direct;
+
+  Loader(API& api, bool direct) : Api(api), Bytes(0), Files(0), Failed(0), Direct(direct) {}
+
+  bool LoadFile(const std::string& path, Asset* a) {
+    if(Direct) {
+      xo::Span s = xo::LoadFileInto(Api, path.c_str(), true);
+      a->FileContents = s.Data;
+      a->Size = s.Size;
+      Files++;
+      Bytes += s.Size;
+      return s.Data != nullptr;
+    }
+    // demo.cpp's load: fopen, ftell for the size, Malloc(size+1), fread.
+    a->FileContents = nullptr;
+    a->Size = 0;
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f) {
+      return false;
+    }
+    fseek(f, 0, SEEK_END);
+    a->Size = ftell(f);
+    rewind(f);
+    a->FileContents = static_cast<char*>(Api.Malloc(a->Size+1));
+    bool ok = a->FileContents && fread(a->FileContents, 1, a->Size, f) == a->Size;
+    fclose(f);
+    if(a->FileContents) {
+      a->FileContents[a->Size] = '\0';
+    }
+    Files++;
+    Bytes += a->Size;
+    return ok;
+  }
+
+  LevelData* Load(const Library& lib, uint32_t index) {
+    const std::vector<uint32_t>& assets = lib.Levels[index];
+    LevelData* level = Api.template New<LevelData>("level" + std::to_string(index), static_cast<uint32_t>(assets.size()));
+    if(!level) {
+      Failed++;
+      return nullptr;
+    }
+    level->Assets = static_cast<Asset*>(Api.Malloc(sizeof(Asset) * assets.size()));
+    if(!level->Assets) {
+      Api.Delete(level);
+      Failed++;
+      return nullptr;
+    }
+    for(uint32_t i = 0; i < level->AssetCount; ++i) {
+      if(!LoadFile(lib.Files[assets[i]], &level->Assets[i])) {
+        Failed++;
+      }
+    }
+    return level;
+  }
+
+  void Unload(LevelData* level) {
+    if(!level) {
+      return;
+    }
+    for(uint32_t i = 0; i < level->AssetCount; ++i) {
+      Api.Free(level->Assets[i].FileContents);
+    }
+    Api.Free(level->Assets);
+    Api.Delete(level);
+  }
+};
+
+inline bool Stats(xo::bench::MallocApi&, xo::BlockStats*) { return false; }
+
+template<uint32_t SIZE>
+bool Stats(xo::bench::BlockApi<SIZE>& api, xo::BlockStats* s) {
+  *s = api.Alloc->GetStats();
+  return true;
+}
+
+enum Pattern { Sequential, Window, Random };
+
+template<typename API>
+void RunPattern(API& api, Suite& suite, const Library& lib, Pattern pattern, bool direct) {
+  const char* names[] = { "assets/sequential", "assets/window", "assets/random" };
+  std::string name = std::string(names[pattern]) + (direct ? "/loadfile" : "/stdio");
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  Loader<API> loader(api, direct);
+  Rng rng(11);
+  std::vector<LevelData*> resident;
+  uint32_t keep = pattern == Sequential ? 1 : LevelsResident;
+  size_t baseRss = xo::bench::ResidentBytes();
+  size_t peakRss = baseRss;
+  float fragMax = 0.0f;
+  uint64_t ns = 0;
+  xo::BlockStats stats;
+
+  for(uint32_t l = 0; l < lib.Levels.size(); ++l) {
+    if(resident.size() == keep) {
+      size_t victim = pattern == Random ? rng.Next() % resident.size() : 0;
+      loader.Unload(resident[victim]);
+      resident.erase(resident.begin() + victim);
+    }
+    uint32_t next = pattern == Random ? rng.Range(0, static_cast<uint32_t>(lib.Levels.size()-1)) : l;
+
+    suite.Start();
+    LevelData* level = loader.Load(lib, next);
+    ns += suite.Stop();
+    resident.push_back(level);
+
+    size_t rss = xo::bench::ResidentBytes();
+    peakRss = rss > peakRss ? rss : peakRss;
+    if(Stats(api, &stats) && stats.Fragmentation() > fragMax) {
+      fragMax = stats.Fragmentation();
+    }
+  }
+  for(LevelData* level : resident) {
+    loader.Unload(level);
+  }
+
+  suite.Add(name, api.Name(), loader.Files, ns);
+  suite.Metric("mib_per_s", ns ? double(loader.Bytes) / double(1u << 20) / (double(ns) / 1e9) : 0.0);
+  suite.Metric("peak_mib", double(peakRss - baseRss) / double(1u << 20));
+  suite.Metric("frag_max", fragMax);
+  suite.Metric("failed", double(loader.Failed));
+}
+
+enum Reader { Stdio, Direct, AsyncUring, AsyncThreads };
+
+template<typename API>
+void RunStartup(API& api, Suite& suite, const Library& lib, Reader reader) {
+  const char* names[] = { "assets/startup/stdio", "assets/startup/loadfile",
+    "assets/startup/async-uring", "assets/startup/async-threads" };
+  if(!suite.Wants(names[reader])) {
+    return;
+  }
+  api.Reset();
+  std::vector<Asset> assets(lib.Files.size());
+  uint64_t bytes = 0;
+  uint64_t failed = 0;
+  uint64_t ns = 0;
+
+  if(reader == Stdio || reader == Direct) {
+    Loader<API> loader(api, reader == Direct);
+    suite.Start();
+    for(size_t i = 0; i < lib.Files.size(); ++i) {
+      failed += loader.LoadFile(lib.Files[i], &assets[i]) ? 0 : 1;
+    }
+    ns = suite.Stop();
+    bytes = loader.Bytes;
+  } else {
+    xo::AsyncLoader<API> loader(api, 64, 4, reader == AsyncUring);
+    if(reader == AsyncUring && !loader.UsingUring()) {
+      return;
+    }
+    suite.Start();
+    for(size_t i = 0; i < lib.Files.size(); ++i) {
+      Asset* a = &assets[i];
+      loader.Load(lib.Files[i].c_str(), [a, &bytes, &failed](const xo::LoadResult& r) {
+        a->FileContents = r.File.Data;
+        a->Size = r.File.Size;
+        bytes += r.File.Size;
+        failed += r.File.Data ? 0 : 1;
+      }, true);
+    }
+    loader.Wait();
+    ns = suite.Stop();
+  }
+
+  for(Asset& a : assets) {
+    api.Free(a.FileContents);
+  }
+  suite.Add(names[reader], api.Name(), lib.Files.size(), ns);
+  suite.Metric("mib_per_s", ns ? double(bytes) / double(1u << 20) / (double(ns) / 1e9) : 0.0);
+  suite.Metric("failed", double(failed));
+}
+
+template<typename API>
+void RunAll(API& api, Suite& suite, const Library& lib) {
+  for(int direct = 0; direct < 2; ++direct) {
+    RunPattern(api, suite, lib, Sequential, direct != 0);
+    RunPattern(api, suite, lib, Window, direct != 0);
+    RunPattern(api, suite, lib, Random, direct != 0);
+  }
+  RunStartup(api, suite, lib, Stdio);
+  RunStartup(api, suite, lib, Direct);
+  RunStartup(api, suite, lib, AsyncUring);
+  RunStartup(api, suite, lib, AsyncThreads);
+}
+
+void Usage() {
+  fprintf(stderr,
+    "usage: bench-assets [--dir path] [--assets n] [--levels n] [--filter text]\n"
+    "                    [--trials n] [--json results.json]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* dir = nullptr;
+  const char* filter = nullptr;
+  const char* json = nullptr;
+  uint32_t assets = 400;
+  uint32_t levels = 200;
+  int trials = 1;
+
+  for(int i = 1; i < argc; ++i) {
+    bool more = i+1 < argc;
+    if(strcmp(argv[i], "--dir") == 0 && more) {
+      dir = argv[++i];
+    } else if(strcmp(argv[i], "--assets") == 0 && more) {
+      assets = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if(strcmp(argv[i], "--levels") == 0 && more) {
+      levels = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if(strcmp(argv[i], "--filter") == 0 && more) {
+      filter = argv[++i];
+    } else if(strcmp(argv[i], "--trials") == 0 && more) {
+      trials = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--json") == 0 && more) {
+      json = argv[++i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(assets == 0 || levels == 0 || trials < 1) {
+    Usage();
+    return 1;
+  }
+
+  Library lib;
+  bool ownDir = !dir;
+  if(ownDir) {
+#if defined(XO_BENCH_DLOPEN)
+    const char* tmp = getenv("TMPDIR");
+    std::string templ = std::string(tmp ? tmp : "/tmp") + "/xo-assets-XXXXXX";
+    std::vector<char> buf(templ.begin(), templ.end());
+    buf.push_back('\0');
+    if(!mkdtemp(buf.data())) {
+      fprintf(stderr, "Couldn't create a temporary directory.\n");
+      return 1;
+    }
+    lib.Dir = buf.data();
+#else
+    lib.Dir = ".";
+    ownDir = false;
+#endif
+  } else {
+    lib.Dir = dir;
+  }
+  if(!Generate(&lib, assets, levels)) {
+    fprintf(stderr, "Couldn't write asset files to \"%s\".\n", lib.Dir.c_str());
+    Cleanup(lib);
+    return 1;
+  }
+
+  Suite suite(filter);
+  for(int t = 0; t < trials; ++t) {
+    xo::bench::MallocApi heap;
+    RunAll(heap, suite, lib);
+    xo::bench::BlockApi<256u << 20> arena("block-256m");
+    RunAll(arena, suite, lib);
+  }
+
+  Cleanup(lib);
+#if defined(XO_BENCH_DLOPEN)
+  if(ownDir) {
+    rmdir(lib.Dir.c_str());
+  }
+#endif
+
+  if(json && !suite.WriteJson(json)) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", json);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,531 @@
+//////////////////////////////////////////////////////////////////////
+//
+// bench-containers.cpp
+//
+// Allocation heavy data structure benchmarks: std::map, std::list,
+// std::unordered_map and string heavy structures built on
+// BlockAllocator through xo::StdAllocator, against the default heap,
+// plus a hand rolled binary tree for BlockAllocator::NewNear.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/bench-containers.cpp -o bench-containers
+//
+// USAGE:
+//   bench-containers [--filter text] [--scale x] [--trials n] [--json results.json]
+//
+// BENCHMARKS (<container>/<phase>):
+//   build     insert n elements in random key order
+//   traverse  walk every element 10 times. No allocation at all, so
+//             this is where the layout an allocator gives shows up.
+//   mutate    erase half the elements and insert as many new ones
+//   traverse-after-mutate
+//             walk again, now that freed memory has been reused
+//   teardown  destroy the container
+//
+//   One op is one element. The arena engine is a fresh
+//   BlockAllocator<64 MiB> per container; "heap" is std::allocator.
+//
+//   tree/* is an unbalanced binary search tree of 2 * n random keys,
+//   built while other allocations churn around it, so free space opens
+//   up all over the arena. block-64m+near allocates each node with
+//   NewNear(parent); the others place it wherever the allocator likes.
+//   Build times include the churn.
+//
+//   arena-list/* links 64 * n nodes into a list in shuffled order and
+//   walks it, once with raw pointer links (block-64m) and once with
+//   ArenaPtr links through ArenaList (block-64m+arenaptr).
+//
+//////////////////////////////////////////////////////////////////////
+#include "xo-bench.h"
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using xo::bench::Rng;
+using xo::bench::Suite;
+
+namespace {
+
+////////////////////////////////////////////////////////////////////// Kits
+
+// A kit names the allocator a container gets for each element type.
+
+struct HeapKit {
+  template<typename T>
+  using Alloc = std::allocator<T>;
+
+  const char* Name() const { return "heap"; }
+  void Reset() {}
+
+  template<typename T>
+  Alloc<T> Make() { return Alloc<T>(); }
+
+  void* Node(const void* near, size_t size) { (void)near; return malloc(size); }
+  void FreeNode(void* m) { free(m); }
+};
+
+struct ArenaKit {
+  typedef xo::BlockAllocator<64u << 20> Arena;
+
+  template<typename T>
+  using Alloc = xo::StdAllocator<T, Arena>;
+
+  Arena* A;
+
+  ArenaKit() : A(new Arena) {}
+  ~ArenaKit() { delete A; }
+
+  const char* Name() const { return "block-64m"; }
+
+  void Reset() {
+    delete A;
+    A = new Arena;
+  }
+
+  template<typename T>
+  Alloc<T> Make() { return Alloc<T>(*A); }
+
+  void* Node(const void* near, size_t size) { (void)near; return A->Malloc(size); }
+  void FreeNode(void* m) { A->Free(m); }
+};
+
+struct NearKit : ArenaKit {
+  const char* Name() const { return "block-64m+near"; }
+  void* Node(const void* near, size_t size) { return A->MallocNear(near, size); }
+};
+
+volatile uint64_t Sink;
+
+std::vector<uint32_t> Shuffled(uint32_t n, uint64_t seed) {
+  std::vector<uint32_t> keys(n);
+  for(uint32_t i = 0; i < n; ++i) {
+    keys[i] = i;
+  }
+  Rng rng(seed);
+  for(uint32_t i = n; i > 1; --i) {
+    std::swap(keys[i-1], keys[rng.Next() % i]);
+  }
+  return keys;
+}
+
+// Times fn between Start/Stop and records it as prefix/phase. A phase
+// the filter doesn't want is skipped, unless a later phase needs what
+// it leaves behind (needed): then it runs, untimed.
+template<typename FN>
+void Phase(Suite& suite, const std::string& prefix, const char* phase, const char* engine,
+  uint64_t ops, FN fn, bool needed = false) {
+  std::string name = prefix + "/" + phase;
+  if(!suite.Wants(name)) {
+    if(needed) {
+      fn();
+    }
+    return;
+  }
+  suite.Start();
+  fn();
+  uint64_t ns = suite.Stop();
+  suite.Add(name, engine, ops, ns);
+}
+
+const char* const ContainerPhases[] = { "build", "traverse", "mutate", "traverse-after-mutate", "teardown" };
+const char* const TreePhases[] = { "build", "traverse", "teardown" };
+const char* const ListPhases[] = { "build", "traverse" };
+
+// Whether the filter wants any of prefix's phases, so a benchmark with
+// nothing wanted doesn't build its data at all.
+template<size_t N>
+bool WantsAny(const Suite& suite, const std::string& prefix, const char* const (&phases)[N]) {
+  for(const char* phase : phases) {
+    if(suite.Wants(prefix + "/" + phase)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////// Benchmarks
+
+template<typename KIT>
+void Map(KIT& kit, Suite& suite, uint32_t n) {
+  if(!WantsAny(suite, "map", ContainerPhases)) {
+    return;
+  }
+  typedef std::pair<const uint32_t, uint64_t> Value;
+  typedef std::map<uint32_t, uint64_t, std::less<uint32_t>, typename KIT::template Alloc<Value> > Container;
+  kit.Reset();
+  std::vector<uint32_t> keys = Shuffled(n * 2, 1);
+  Container* c = new Container(kit.template Make<Value>());
+  auto traverse = [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      for(const Value& v : *c) {
+        sum += v.second;
+      }
+    }
+    Sink = sum;
+  };
+
+  Phase(suite, "map", "build", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; ++i) {
+      c->insert(Value(keys[i], i));
+    }
+  }, true);
+  Phase(suite, "map", "traverse", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "map", "mutate", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; i += 2) {
+      c->erase(keys[i]);
+      c->insert(Value(keys[n+i], i));
+    }
+  }, suite.Wants("map/traverse-after-mutate"));
+  Phase(suite, "map", "traverse-after-mutate", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "map", "teardown", kit.Name(), n, [&] { delete c; }, true);
+}
+
+template<typename KIT>
+void List(KIT& kit, Suite& suite, uint32_t n) {
+  if(!WantsAny(suite, "list", ContainerPhases)) {
+    return;
+  }
+  typedef std::list<uint64_t, typename KIT::template Alloc<uint64_t> > Container;
+  kit.Reset();
+  Container* c = new Container(kit.template Make<uint64_t>());
+  auto traverse = [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      for(uint64_t v : *c) {
+        sum += v;
+      }
+    }
+    Sink = sum;
+  };
+
+  Phase(suite, "list", "build", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; ++i) {
+      c->push_back(i);
+    }
+  }, true);
+  Phase(suite, "list", "traverse", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "list", "mutate", kit.Name(), n, [&] {
+    // drop every other node and put a new one beside each survivor.
+    for(typename Container::iterator it = c->begin(); it != c->end();) {
+      it = c->erase(it);
+      if(it != c->end()) {
+        c->insert(it, *it + 1);
+        ++it;
+      }
+    }
+  }, suite.Wants("list/traverse-after-mutate"));
+  Phase(suite, "list", "traverse-after-mutate", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "list", "teardown", kit.Name(), n, [&] { delete c; }, true);
+}
+
+template<typename KIT>
+void UnorderedMap(KIT& kit, Suite& suite, uint32_t n) {
+  if(!WantsAny(suite, "unordered_map", ContainerPhases)) {
+    return;
+  }
+  typedef std::pair<const uint32_t, uint64_t> Value;
+  typedef std::unordered_map<uint32_t, uint64_t, std::hash<uint32_t>, std::equal_to<uint32_t>,
+    typename KIT::template Alloc<Value> > Container;
+  kit.Reset();
+  std::vector<uint32_t> keys = Shuffled(n * 2, 2);
+  Container* c = new Container(0, std::hash<uint32_t>(), std::equal_to<uint32_t>(), kit.template Make<Value>());
+  auto traverse = [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      for(const Value& v : *c) {
+        sum += v.second;
+      }
+    }
+    Sink = sum;
+  };
+
+  Phase(suite, "unordered_map", "build", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; ++i) {
+      c->insert(Value(keys[i], i));
+    }
+  }, true);
+  Phase(suite, "unordered_map", "traverse", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "unordered_map", "mutate", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; i += 2) {
+      c->erase(keys[i]);
+      c->insert(Value(keys[n+i], i));
+    }
+  }, suite.Wants("unordered_map/traverse-after-mutate"));
+  Phase(suite, "unordered_map", "traverse-after-mutate", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "unordered_map", "teardown", kit.Name(), n, [&] { delete c; }, true);
+}
+
+template<typename KIT>
+void Strings(KIT& kit, Suite& suite, uint32_t n) {
+  if(!WantsAny(suite, "strings", ContainerPhases)) {
+    return;
+  }
+  typedef std::basic_string<char, std::char_traits<char>, typename KIT::template Alloc<char> > String;
+  typedef std::vector<String, typename KIT::template Alloc<String> > Container;
+  kit.Reset();
+  Rng rng(3);
+  Container* c = new Container(kit.template Make<String>());
+  auto traverse = [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      for(const String& s : *c) {
+        for(char ch : s) {
+          sum += static_cast<unsigned char>(ch);
+        }
+      }
+    }
+    Sink = sum;
+  };
+
+  // all longer than the small string buffer, so each one allocates.
+  Phase(suite, "strings", "build", kit.Name(), n, [&] {
+    for(uint32_t i = 0; i < n; ++i) {
+      c->push_back(String(rng.Range(24, 80), static_cast<char>('a' + i % 26), kit.template Make<char>()));
+    }
+  }, true);
+  Phase(suite, "strings", "traverse", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "strings", "mutate", kit.Name(), n, [&] {
+    // grow half the strings past their capacity, shrink the others.
+    for(uint32_t i = 0; i < n; ++i) {
+      String& s = (*c)[i];
+      if(i % 2) {
+        s.append(s.size(), 'z');
+      } else {
+        String shorter(s.data(), 20, kit.template Make<char>());
+        s.swap(shorter);
+      }
+    }
+  }, suite.Wants("strings/traverse-after-mutate"));
+  Phase(suite, "strings", "traverse-after-mutate", kit.Name(), uint64_t(n) * 10, traverse);
+  Phase(suite, "strings", "teardown", kit.Name(), n, [&] { delete c; }, true);
+}
+
+struct TreeNode {
+  uint32_t Key;
+  uint64_t Value;
+  TreeNode* Child[2];
+};
+
+uint64_t SumTree(const TreeNode* t) {
+  return t ? SumTree(t->Child[0]) + t->Value + SumTree(t->Child[1]) : 0;
+}
+
+double ParentDistance(const TreeNode* t, const TreeNode* parent) {
+  if(!t) {
+    return 0.0;
+  }
+  const char* a = reinterpret_cast<const char*>(t);
+  const char* b = reinterpret_cast<const char*>(parent);
+  double d = parent ? double(a > b ? a - b : b - a) : 0.0;
+  return d + ParentDistance(t->Child[0], t) + ParentDistance(t->Child[1], t);
+}
+
+void FreeTree(TreeNode* t, std::function<void(void*)> freeNode) {
+  if(t) {
+    FreeTree(t->Child[0], freeNode);
+    FreeTree(t->Child[1], freeNode);
+    freeNode(t);
+  }
+}
+
+template<typename KIT>
+void Tree(KIT& kit, Suite& suite, uint32_t n) {
+  if(!WantsAny(suite, "tree", TreePhases)) {
+    return;
+  }
+  kit.Reset();
+  uint32_t count = n * 2;
+  std::vector<uint32_t> keys = Shuffled(count, 4);
+
+  // other work churns alongside the tree: each insert replaces a
+  // random one of these, so free space opens up all over the arena.
+  Rng rng(5);
+  std::vector<void*> noise(count / 2);
+  for(void*& m : noise) {
+    m = kit.Node(nullptr, rng.Range(16, 96));
+  }
+
+  TreeNode* root = nullptr;
+  Phase(suite, "tree", "build", kit.Name(), count, [&] {
+    for(uint32_t i = 0; i < count; ++i) {
+      TreeNode* parent = nullptr;
+      TreeNode** link = &root;
+      while(*link) {
+        parent = *link;
+        link = &parent->Child[keys[i] > parent->Key];
+      }
+      TreeNode* t = static_cast<TreeNode*>(kit.Node(parent, sizeof(TreeNode)));
+      t->Key = keys[i];
+      t->Value = i;
+      t->Child[0] = t->Child[1] = nullptr;
+      *link = t;
+      void*& m = noise[rng.Next() % noise.size()];
+      kit.FreeNode(m);
+      m = kit.Node(nullptr, rng.Range(16, 96));
+    }
+  }, true);
+  if(suite.Wants("tree/build")) {
+    suite.Metric("mean bytes to parent", ParentDistance(root, nullptr) / double(count - 1));
+  }
+  Phase(suite, "tree", "traverse", kit.Name(), uint64_t(count) * 10, [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      sum += SumTree(root);
+    }
+    Sink = sum;
+  });
+  Phase(suite, "tree", "teardown", kit.Name(), count, [&] {
+    FreeTree(root, [&](void* m) { kit.FreeNode(m); });
+  }, true);
+
+  for(void* m : noise) {
+    kit.FreeNode(m);
+  }
+}
+
+// The same list twice: linked by raw pointers, and by ArenaPtr
+// through xo::ArenaList, which halves the node.
+struct RawNode {
+  uint32_t Value;
+  RawNode* Next;
+  RawNode* Prev;
+};
+
+struct RawList {
+  RawNode* Head;
+  RawNode* Tail;
+
+  explicit RawList(const void*) : Head(nullptr), Tail(nullptr) {}
+  RawNode* Front() const { return Head; }
+  RawNode* Next(const RawNode* n) const { return n->Next; }
+
+  void PushBack(RawNode* n) {
+    n->Next = nullptr;
+    n->Prev = Tail;
+    (Tail ? Tail->Next : Head) = n;
+    Tail = n;
+  }
+};
+
+struct CompactNode {
+  uint32_t Value;
+  xo::ArenaLink<CompactNode> Link;
+};
+
+typedef xo::ArenaList<CompactNode, &CompactNode::Link> CompactList;
+
+template<typename NODE, typename LIST>
+void ArenaListBench(Suite& suite, const char* engine, uint32_t n) {
+  static_assert(alignof(NODE) <= xo::BlockCore::Align, "BlockAllocator payloads aren't aligned enough for this node");
+  if(!WantsAny(suite, "arena-list", ListPhases)) {
+    return;
+  }
+  typedef xo::BlockAllocator<64u << 20> Arena;
+  Arena* arena = new Arena;
+  uint32_t count = n * 64;
+  const uint32_t batch = 1024;
+
+  // nodes come from the arena a batch at a time, so building isn't
+  // dominated by first fit; they're linked in shuffled order. Each
+  // batch starts aligned for NODE, and sizeof(NODE) keeps the rest so.
+  std::vector<NODE*> nodes;
+  for(uint32_t i = 0; i < count; i += batch) {
+    NODE* b = static_cast<NODE*>(arena->Malloc(sizeof(NODE) * batch));
+    for(uint32_t j = 0; j < batch && i + j < count; ++j) {
+      nodes.push_back(b + j);
+    }
+  }
+  std::vector<uint32_t> order = Shuffled(count, 6);
+  LIST list(arena->Base());
+
+  Phase(suite, "arena-list", "build", engine, count, [&] {
+    for(uint32_t i : order) {
+      NODE* node = nodes[i];
+      node->Value = i;
+      list.PushBack(node);
+    }
+  }, true);
+  if(suite.Wants("arena-list/build")) {
+    suite.Metric("node bytes", sizeof(NODE));
+  }
+  Phase(suite, "arena-list", "traverse", engine, uint64_t(count) * 10, [&] {
+    uint64_t sum = 0;
+    for(int r = 0; r < 10; ++r) {
+      for(NODE* node = list.Front(); node; node = list.Next(node)) {
+        sum += node->Value;
+      }
+    }
+    Sink = sum;
+  });
+  delete arena;
+}
+
+template<typename KIT>
+void RunAll(KIT& kit, Suite& suite, uint32_t n) {
+  Map(kit, suite, n);
+  List(kit, suite, n);
+  UnorderedMap(kit, suite, n);
+  Strings(kit, suite, n);
+  Tree(kit, suite, n);
+}
+
+void Usage() {
+  fprintf(stderr, "usage: bench-containers [--filter text] [--scale x] [--trials n] [--json results.json]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* filter = nullptr;
+  const char* json = nullptr;
+  double scale = 1.0;
+  int trials = 1;
+
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+      filter = argv[++i];
+    } else if(strcmp(argv[i], "--scale") == 0 && i+1 < argc) {
+      scale = atof(argv[++i]);
+    } else if(strcmp(argv[i], "--trials") == 0 && i+1 < argc) {
+      trials = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+      json = argv[++i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  uint32_t n = static_cast<uint32_t>(10000 * scale);
+  if(n < 2 || trials < 1) {
+    Usage();
+    return 1;
+  }
+
+  Suite suite(filter);
+  for(int t = 0; t < trials; ++t) {
+    HeapKit heap;
+    RunAll(heap, suite, n);
+    ArenaKit arena;
+    RunAll(arena, suite, n);
+    NearKit near;
+    Tree(near, suite, n);
+    ArenaListBench<RawNode, RawList>(suite, "block-64m", n);
+    ArenaListBench<CompactNode, CompactList>(suite, "block-64m+arenaptr", n);
+  }
+
+  if(json && !suite.WriteJson(json)) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", json);
+    return 1;
+  }
+  return 0;
+}
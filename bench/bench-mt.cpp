@@ -0,0 +1,557 @@
+//////////////////////////////////////////////////////////////////////
+//
+// bench-mt.cpp
+//
+// Multithreaded allocator stress benchmarks, scaled from 1 to N
+// threads: Larson, threadtest, producer/consumer and the
+// cache-scratch/cache-thrash false sharing tests.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 -pthread bench/bench-mt.cpp -o bench-mt -ldl
+//
+// USAGE:
+//   bench-mt [--threads 1,2,4,...] [--filter text] [--scale x] [--json results.json]
+//
+//   --threads  thread counts to run. Defaults to powers of two up to
+//              the hardware thread count, plus that count itself.
+//
+// ENGINES:
+//   The allocators in xo-alloc.h are single threaded; nothing in them
+//   takes a lock. These benchmarks show the two ways to share them:
+//
+//   block-locked      one BlockAllocator<256 MiB> behind a std::mutex.
+//   block-per-thread  one BlockAllocator<16 MiB> per thread. Can't run
+//                     the benchmarks that free on another thread.
+//   ring-spsc         one SpscRingAllocator<1 MiB> per producer/consumer
+//                     pair. prodcons only.
+//
+//   plus malloc and whichever of jemalloc/tcmalloc/mimalloc are found.
+//
+// BENCHMARKS (name/t<threads>, or name/p<pairs> for prodcons):
+//   threadtest     each thread allocates 2000 64 byte blocks and frees
+//                  them all, repeatedly. No sharing at all.
+//   larson         each thread churns random sized blocks in its own
+//                  slot array. Every generation new threads take over
+//                  the arrays, so blocks are freed by a thread other
+//                  than the one that allocated them.
+//   prodcons       producers allocate and hand blocks through a queue
+//                  to consumers, who free them.
+//   cache-thrash   each thread allocates a tiny block, writes it many
+//                  times and frees it. Slows down if the allocator
+//                  hands neighbouring bytes to different threads.
+//   cache-scratch  as cache-thrash, but each thread first frees a tiny
+//                  block the main thread allocated next to the others'.
+//
+//   ops/s counts allocations + frees (writes, for the cache tests).
+//   Hardware counters, where available, cover every worker thread.
+//   "blowup" is the process's peak resident growth divided by the
+//   most bytes the benchmark had live at once. 1.0 is perfect.
+//
+//////////////////////////////////////////////////////////////////////
+#include "xo-bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using xo::bench::Rng;
+using xo::bench::Suite;
+
+namespace {
+
+////////////////////////////////////////////////////////////////////// Apis
+
+// Every Api also has ThreadBegin/ThreadEnd, called on each worker
+// thread, and CrossThread, false if a block must be freed on the
+// thread that allocated it.
+
+struct MallocMt : xo::bench::MallocApi {
+  static const bool CrossThread = true;
+  void ThreadBegin() {}
+  void ThreadEnd() {}
+};
+
+struct DlMt : xo::bench::DlApi {
+  static const bool CrossThread = true;
+  void ThreadBegin() {}
+  void ThreadEnd() {}
+};
+
+struct LockedBlockMt {
+  typedef xo::BlockAllocator<256u << 20> Allocator;
+  static const bool CrossThread = true;
+
+  std::mutex Lock;
+  Allocator* Alloc;
+
+  LockedBlockMt() : Alloc(new Allocator) {}
+  ~LockedBlockMt() { delete Alloc; }
+
+  const char* Name() const { return "block-locked"; }
+  void ThreadBegin() {}
+  void ThreadEnd() {}
+
+  void* Malloc(size_t size) {
+    std::lock_guard<std::mutex> lock(Lock);
+    return Alloc->Malloc(size);
+  }
+
+  void Free(void* m) {
+    std::lock_guard<std::mutex> lock(Lock);
+    Alloc->Free(m);
+  }
+};
+
+struct PerThreadBlockMt {
+  typedef xo::BlockAllocator<16u << 20> Allocator;
+  static const bool CrossThread = false;
+  static thread_local Allocator* t_Alloc;
+
+  const char* Name() const { return "block-per-thread"; }
+  void ThreadBegin() { t_Alloc = new Allocator; }
+  void ThreadEnd() { delete t_Alloc; t_Alloc = nullptr; }
+  void* Malloc(size_t size) { return t_Alloc->Malloc(size); }
+  void Free(void* m) { t_Alloc->Free(m); }
+};
+thread_local PerThreadBlockMt::Allocator* PerThreadBlockMt::t_Alloc = nullptr;
+
+////////////////////////////////////////////////////////////////////// Harness
+
+// Polls resident memory while a benchmark runs, keeping the peak.
+class RssSampler {
+public:
+  RssSampler() : m_Base(xo::bench::ResidentBytes()), m_Peak(m_Base), m_Stop(false) {
+    m_Thread = std::thread([this] {
+      while(!m_Stop.load(std::memory_order_relaxed)) {
+        Sample();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  // Peak growth over the resident size when we started.
+  size_t Stop() {
+    m_Stop.store(true);
+    m_Thread.join();
+    Sample();
+    return m_Peak > m_Base ? m_Peak - m_Base : 0;
+  }
+
+private:
+  void Sample() {
+    size_t rss = xo::bench::ResidentBytes();
+    if(rss > m_Peak) {
+      m_Peak = rss;
+    }
+  }
+
+  size_t m_Base;
+  size_t m_Peak;
+  std::atomic<bool> m_Stop;
+  std::thread m_Thread;
+};
+
+// Runs fn(i) on n threads, released together. Returns wall nanoseconds
+// from the release until the last thread finishes. Hardware counters
+// cover the same span, across all the threads.
+template<typename FN>
+uint64_t RunThreads(Suite& suite, uint32_t n, FN fn) {
+  std::atomic<uint32_t> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> threads;
+  for(uint32_t i = 0; i < n; ++i) {
+    threads.push_back(std::thread([&, i] {
+      ready.fetch_add(1);
+      while(!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      fn(i);
+    }));
+  }
+  while(ready.load() != n) {
+    std::this_thread::yield();
+  }
+  suite.Start();
+  go.store(true, std::memory_order_release);
+  for(std::thread& t : threads) {
+    t.join();
+  }
+  return suite.Stop();
+}
+
+inline void Touch(void* m) {
+  if(m) {
+    *static_cast<volatile char*>(m) = 1;
+  }
+}
+
+void Report(Suite& suite, const std::string& name, const char* engine, uint64_t ops, uint64_t ns,
+  size_t peakLive, size_t rssGrowth) {
+  suite.Add(name, engine, ops, ns);
+  if(peakLive) {
+    suite.Metric("blowup", double(rssGrowth) / double(peakLive));
+  }
+}
+
+////////////////////////////////////////////////////////////////////// Benchmarks
+
+template<typename API>
+void ThreadTest(API& api, Suite& suite, uint32_t threads, double scale) {
+  std::string name = "threadtest/t" + std::to_string(threads);
+  if(!suite.Wants(name)) {
+    return;
+  }
+  const uint32_t objects = 2000;
+  const uint32_t size = 64;
+  const uint32_t rounds = static_cast<uint32_t>(200 * scale) + 1;
+
+  RssSampler rss;
+  uint64_t ns = RunThreads(suite, threads, [&](uint32_t) {
+    api.ThreadBegin();
+    std::vector<void*> ptrs(objects);
+    for(uint32_t r = 0; r < rounds; ++r) {
+      for(void*& m : ptrs) {
+        m = api.Malloc(size);
+        Touch(m);
+      }
+      for(void* m : ptrs) {
+        api.Free(m);
+      }
+    }
+    api.ThreadEnd();
+  });
+  size_t growth = rss.Stop();
+  Report(suite, name, api.Name(), uint64_t(threads) * rounds * objects * 2, ns,
+    size_t(threads) * objects * size, growth);
+}
+
+struct LarsonSlots {
+  std::vector<void*> Ptrs;
+  std::vector<uint32_t> Sizes;
+  Rng Random;
+  size_t Live;
+  size_t Peak;
+};
+
+template<typename API>
+void Larson(API& api, Suite& suite, uint32_t threads, double scale) {
+  std::string name = "larson/t" + std::to_string(threads);
+  if(!API::CrossThread || !suite.Wants(name)) {
+    return;
+  }
+  const uint32_t slots = 1000;
+  const uint32_t generations = 4;
+  const uint32_t opsPerGeneration = static_cast<uint32_t>(50000 * scale) + 1;
+
+  RssSampler rss;
+  std::vector<LarsonSlots> state(threads);
+  for(uint32_t t = 0; t < threads; ++t) {
+    LarsonSlots& s = state[t];
+    s.Random = Rng(t + 1);
+    s.Ptrs.resize(slots);
+    s.Sizes.resize(slots);
+    s.Live = 0;
+    for(uint32_t i = 0; i < slots; ++i) {
+      s.Sizes[i] = s.Random.Range(16, 512);
+      s.Ptrs[i] = api.Malloc(s.Sizes[i]);
+      Touch(s.Ptrs[i]);
+      s.Live += s.Sizes[i];
+    }
+    s.Peak = s.Live;
+  }
+
+  uint64_t ns = 0;
+  for(uint32_t g = 0; g < generations; ++g) {
+    ns += RunThreads(suite, threads, [&](uint32_t t) {
+      api.ThreadBegin();
+      LarsonSlots& s = state[t];
+      for(uint32_t i = 0; i < opsPerGeneration; ++i) {
+        uint32_t slot = s.Random.Range(0, slots-1);
+        api.Free(s.Ptrs[slot]);
+        s.Live -= s.Sizes[slot];
+        s.Sizes[slot] = s.Random.Range(16, 512);
+        s.Ptrs[slot] = api.Malloc(s.Sizes[slot]);
+        Touch(s.Ptrs[slot]);
+        s.Live += s.Sizes[slot];
+        if(s.Live > s.Peak) {
+          s.Peak = s.Live;
+        }
+      }
+      api.ThreadEnd();
+    });
+  }
+  size_t growth = rss.Stop();
+
+  size_t peak = 0;
+  for(LarsonSlots& s : state) {
+    for(void* m : s.Ptrs) {
+      api.Free(m);
+    }
+    peak += s.Peak;
+  }
+  Report(suite, name, api.Name(), uint64_t(threads) * generations * opsPerGeneration * 2, ns, peak, growth);
+}
+
+// Single producer, single consumer queue of pointers.
+class PtrQueue {
+public:
+  static const uint32_t Capacity = 1024;
+
+  PtrQueue() : m_Head(0), m_Tail(0) {}
+
+  bool Push(void* m) {
+    uint32_t head = m_Head.load(std::memory_order_relaxed);
+    if(head - m_Tail.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    m_Slots[head % Capacity] = m;
+    m_Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  void* Pop() {
+    uint32_t tail = m_Tail.load(std::memory_order_relaxed);
+    if(tail == m_Head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    void* m = m_Slots[tail % Capacity];
+    m_Tail.store(tail + 1, std::memory_order_release);
+    return m;
+  }
+
+private:
+  // padded so producer and consumer don't share the index cache lines.
+  void* m_Slots[Capacity];
+  std::atomic<uint32_t> m_Head;
+  char m_Pad[64];
+  std::atomic<uint32_t> m_Tail;
+};
+
+template<typename API>
+void ProdCons(API& api, Suite& suite, uint32_t threads, double scale) {
+  uint32_t pairs = threads / 2 ? threads / 2 : 1;
+  std::string name = "prodcons/p" + std::to_string(pairs);
+  if(!API::CrossThread || !suite.Wants(name)) {
+    return;
+  }
+  const uint32_t size = 64;
+  const uint32_t items = static_cast<uint32_t>(200000 * scale) + 1;
+
+  std::vector<PtrQueue> queues(pairs);
+  RssSampler rss;
+  uint64_t ns = RunThreads(suite, pairs * 2, [&](uint32_t t) {
+    api.ThreadBegin();
+    PtrQueue& q = queues[t / 2];
+    if(t % 2 == 0) {
+      for(uint32_t i = 0; i < items; ++i) {
+        void* m = api.Malloc(size);
+        Touch(m);
+        while(!q.Push(m)) {
+          std::this_thread::yield();
+        }
+      }
+    } else {
+      for(uint32_t i = 0; i < items;) {
+        if(void* m = q.Pop()) {
+          api.Free(m);
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }
+    api.ThreadEnd();
+  });
+  size_t growth = rss.Stop();
+  Report(suite, name, api.Name(), uint64_t(pairs) * items * 2, ns,
+    size_t(pairs) * PtrQueue::Capacity * size, growth);
+}
+
+// prodcons with each pair sharing its own lock free ring: the producer
+// allocates, the consumer frees, always in FIFO order.
+void ProdConsRing(Suite& suite, uint32_t threads, double scale) {
+  typedef xo::SpscRingAllocator<1u << 20> Ring;
+  uint32_t pairs = threads / 2 ? threads / 2 : 1;
+  std::string name = "prodcons/p" + std::to_string(pairs);
+  if(!suite.Wants(name)) {
+    return;
+  }
+  const uint32_t size = 64;
+  const uint32_t items = static_cast<uint32_t>(200000 * scale) + 1;
+
+  std::vector<PtrQueue> queues(pairs);
+  std::vector<Ring*> rings(pairs);
+  for(Ring*& r : rings) {
+    r = new Ring;
+  }
+  RssSampler rss;
+  uint64_t ns = RunThreads(suite, pairs * 2, [&](uint32_t t) {
+    PtrQueue& q = queues[t / 2];
+    Ring& ring = *rings[t / 2];
+    if(t % 2 == 0) {
+      for(uint32_t i = 0; i < items; ++i) {
+        void* m;
+        while(!(m = ring.Malloc(size))) {
+          std::this_thread::yield();
+        }
+        Touch(m);
+        while(!q.Push(m)) {
+          std::this_thread::yield();
+        }
+      }
+    } else {
+      for(uint32_t i = 0; i < items;) {
+        if(void* m = q.Pop()) {
+          ring.Free(m);
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }
+  });
+  size_t growth = rss.Stop();
+  for(Ring* r : rings) {
+    delete r;
+  }
+  Report(suite, name, "ring-spsc", uint64_t(pairs) * items * 2, ns,
+    size_t(pairs) * PtrQueue::Capacity * size, growth);
+}
+
+template<typename API>
+void CacheTest(API& api, Suite& suite, uint32_t threads, double scale, bool scratch) {
+  std::string name = std::string(scratch ? "cache-scratch/t" : "cache-thrash/t") + std::to_string(threads);
+  if((scratch && !API::CrossThread) || !suite.Wants(name)) {
+    return;
+  }
+  const uint32_t size = 8;
+  const uint32_t iterations = static_cast<uint32_t>(2000 * scale) + 1;
+  const uint32_t writes = 1000;
+
+  // allocated together on this thread, so likely sharing cache lines.
+  std::vector<void*> handoff(threads, nullptr);
+  if(scratch) {
+    for(void*& m : handoff) {
+      m = api.Malloc(size);
+    }
+  }
+
+  uint64_t ns = RunThreads(suite, threads, [&](uint32_t t) {
+    api.ThreadBegin();
+    if(handoff[t]) {
+      api.Free(handoff[t]);
+    }
+    for(uint32_t i = 0; i < iterations; ++i) {
+      volatile char* m = static_cast<volatile char*>(api.Malloc(size));
+      for(uint32_t w = 0; w < writes; ++w) {
+        m[0] = m[0] + 1;
+      }
+      api.Free(const_cast<char*>(m));
+    }
+    api.ThreadEnd();
+  });
+  Report(suite, name, api.Name(), uint64_t(threads) * iterations * writes, ns, 0, 0);
+}
+
+template<typename API>
+void RunAll(API& api, Suite& suite, const std::vector<uint32_t>& threadCounts, double scale) {
+  for(uint32_t t : threadCounts) {
+    ThreadTest(api, suite, t, scale);
+    Larson(api, suite, t, scale);
+    ProdCons(api, suite, t, scale);
+    CacheTest(api, suite, t, scale, false);
+    CacheTest(api, suite, t, scale, true);
+  }
+}
+
+std::vector<uint32_t> DefaultThreadCounts() {
+  uint32_t hw = std::thread::hardware_concurrency();
+  hw = hw ? hw : 1;
+  std::vector<uint32_t> counts;
+  for(uint32_t t = 1; t < hw; t *= 2) {
+    counts.push_back(t);
+  }
+  counts.push_back(hw);
+  return counts;
+}
+
+void Usage() {
+  fprintf(stderr, "usage: bench-mt [--threads 1,2,4,...] [--filter text] [--scale x] [--json results.json]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* filter = nullptr;
+  const char* json = nullptr;
+  double scale = 1.0;
+  std::vector<uint32_t> threadCounts;
+
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+      for(char* s = argv[++i]; *s;) {
+        char* end = s;
+        unsigned long t = strtoul(s, &end, 10);
+        if(end == s || t == 0) {
+          Usage();
+          return 1;
+        }
+        threadCounts.push_back(static_cast<uint32_t>(t));
+        s = *end == ',' ? end+1 : end;
+      }
+    } else if(strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+      filter = argv[++i];
+    } else if(strcmp(argv[i], "--scale") == 0 && i+1 < argc) {
+      scale = atof(argv[++i]);
+    } else if(strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+      json = argv[++i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(scale <= 0.0) {
+    Usage();
+    return 1;
+  }
+  if(threadCounts.empty()) {
+    threadCounts = DefaultThreadCounts();
+  }
+
+  Suite suite(filter);
+
+  MallocMt mallocApi;
+  RunAll(mallocApi, suite, threadCounts, scale);
+
+  const char* dlNames[] = { "jemalloc", "tcmalloc", "mimalloc" };
+  for(const char* name : dlNames) {
+    DlMt dl;
+    if(xo::bench::LoadDlMalloc(name, &dl.Fns)) {
+      RunAll(dl, suite, threadCounts, scale);
+    } else {
+      printf("%s not found, skipping.\n", name);
+    }
+  }
+
+  LockedBlockMt locked;
+  RunAll(locked, suite, threadCounts, scale);
+
+  PerThreadBlockMt perThread;
+  RunAll(perThread, suite, threadCounts, scale);
+
+  for(uint32_t t : threadCounts) {
+    ProdConsRing(suite, t, scale);
+  }
+
+  if(json && !suite.WriteJson(json)) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", json);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,500 @@
+//////////////////////////////////////////////////////////////////////
+//
+// bench.cpp
+//
+// Microbenchmarks of xo::BlockAllocator against the C runtime malloc
+// and any jemalloc/tcmalloc/mimalloc installed on this machine.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/bench.cpp -o bench -ldl
+//
+// USAGE:
+//   bench [--filter text] [--engine name]... [--scale x] [--trials n]
+//         [--json results.json] [--baseline baseline.json] [--threshold x]
+//
+//   --filter     only run benchmarks whose name contains text
+//   --engine     only run this engine; repeat for several (malloc,
+//                jemalloc, tcmalloc, mimalloc, block-16m,
+//                block-16m+classes, ring-1m, frame-1m)
+//   --scale      multiply every benchmark's op count by x (default 1)
+//   --trials     run everything n times and report the median
+//   --json       also write the results to a JSON file (see xo-bench.h)
+//   --baseline   compare against a results file and exit with status 2
+//                if any benchmark got slower than it's allowed to
+//   --threshold  slowdown allowed on top of the baseline's own trial
+//                spread, for entries without their own "threshold"
+//                (default 0.1, i.e. 10%)
+//
+// REGRESSION GATE:
+//   bench/baseline.json holds the BlockAllocator numbers the library
+//   is held to. Check a change with
+//
+//     bench --engine block-16m --trials 5 --scale 0.25 --baseline bench/baseline.json
+//
+//   The gate compares the fastest trial of each benchmark, and its
+//   fastest p99 latency, allowing the threshold plus the spread the
+//   baseline's trials showed (see BASELINES in xo-bench.h). The file
+//   records the host, compiler, scale and trials it was made with, and
+//   the gate warns when they don't match. Timings only compare on the
+//   same machine and compiler, so when the gate moves to new hardware,
+//   or a change is meant to speed things up, regenerate it with the
+//   same flags and --json bench/baseline.json.
+//
+// BENCHMARKS:
+//   churn/*       keep a window of live blocks, then repeatedly free a
+//                 random one and allocate its replacement. One op is
+//                 one Free + one Malloc.
+//   order/*       allocate a batch, then free it newest first (lifo)
+//                 or oldest first (fifo). One op is one Malloc or Free.
+//   stream/*      a pipeline: keep a window of records in flight, free
+//                 the oldest and allocate a new one. One op is one
+//                 Free + one Malloc.
+//   frame/*       a game loop: each frame frees the blocks of the
+//                 frame before last, then allocates its own, which
+//                 must live through the next frame. One op is one
+//                 block, allocated and released.
+//   fill/*        allocate fixed size blocks until the engine is out
+//                 of room (16 MiB for the others), then free them all.
+//   new-delete/*  New/Delete of a type with a std::string member and a
+//                 non-trivial constructor and destructor.
+//
+//   Every benchmark also samples per op latency, p50 and p99 (see
+//   LATENCY in xo-bench.h).
+//
+//   Where perf_event_open works, each result also gets hardware counters
+//   per op (cycles, instructions, cache/TLB/branch misses). See
+//   COUNTERS in xo-bench.h.
+//
+//   The BlockAllocator engine is a fresh BlockAllocator<16 MiB> per
+//   benchmark; block-16m+classes is the same with the SmallClasses
+//   size classes. ring-1m is a RingAllocator<1 MiB>, and only runs the
+//   stream and frame benchmarks, the ones that free in FIFO order.
+//   frame-1m is a FrameAllocator<1 MiB, 2> and only runs frame/*,
+//   where its BeginFrame replaces every Free. The other engines are
+//   called through plain function calls, never a virtual, so inlining
+//   is the same for everyone.
+//
+//////////////////////////////////////////////////////////////////////
+#include "xo-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using xo::bench::Rng;
+using xo::bench::Suite;
+
+namespace {
+
+static const uint32_t ArenaSize = 16u << 20;
+
+typedef xo::SizeClasses<16, 32, 48, 64, 96, 128, 192, 256> SmallClasses;
+
+////////////////////////////////////////////////////////////////////// Workloads
+
+struct Widget {
+  Widget(const char* name, int id) : Name(name), Id(id), Score(0.0f) {
+    Name[0] = 'w';
+  }
+  ~Widget() {
+    Sink += Id + static_cast<int>(Name.size());
+  }
+
+  std::string Name; // short enough for the small string buffer
+  int Id;
+  float Score;
+  static volatile int Sink;
+};
+volatile int Widget::Sink = 0;
+
+// the compiler may drop a malloc/free pair whose memory is never used.
+inline void Touch(void* m) {
+  if(m) {
+    *static_cast<volatile char*>(m) = 1;
+  }
+}
+
+struct Churn {
+  std::vector<uint32_t> Sizes;   // one per op, plus one per initial slot
+  std::vector<uint32_t> Slots;   // which live block each op replaces
+};
+
+Churn MakeChurn(uint32_t live, uint64_t ops, uint32_t lo, uint32_t hi, bool logScale) {
+  Rng rng;
+  Churn c;
+  c.Sizes.resize(live + ops);
+  c.Slots.resize(ops);
+  for(uint32_t& s : c.Sizes) {
+    if(!logScale) {
+      s = rng.Range(lo, hi);
+    } else {
+      // pick a power of two bucket uniformly, then a size inside it.
+      uint32_t buckets = 0;
+      while((lo << (buckets+1)) <= hi) {
+        ++buckets;
+      }
+      uint32_t b = lo << rng.Range(0, buckets);
+      s = rng.Range(b, b*2-1 < hi ? b*2-1 : hi);
+    }
+  }
+  for(uint32_t& s : c.Slots) {
+    s = rng.Range(0, live-1);
+  }
+  return c;
+}
+
+template<typename API>
+void RunChurn(API& api, Suite& suite, const char* name, const Churn& c) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  uint32_t live = static_cast<uint32_t>(c.Sizes.size() - c.Slots.size());
+  std::vector<void*> ptrs(live);
+  for(uint32_t i = 0; i < live; ++i) {
+    ptrs[i] = api.Malloc(c.Sizes[i]);
+    Touch(ptrs[i]);
+  }
+
+  suite.Start();
+  for(size_t i = 0; i < c.Slots.size(); ++i) {
+    uint64_t t = suite.OpBegin(i);
+    void*& slot = ptrs[c.Slots[i]];
+    api.Free(slot);
+    slot = api.Malloc(c.Sizes[live+i]);
+    Touch(slot);
+    suite.OpEnd(t);
+  }
+  uint64_t ns = suite.Stop();
+
+  for(void* m : ptrs) {
+    api.Free(m);
+  }
+  suite.Add(name, api.Name(), c.Slots.size(), ns);
+}
+
+template<typename API>
+void RunOrder(API& api, Suite& suite, const char* name, const std::vector<uint32_t>& sizes,
+  uint32_t batch, bool lifo) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  std::vector<void*> ptrs(batch);
+  uint64_t ops = 0;
+
+  suite.Start();
+  for(size_t base = 0; base + batch <= sizes.size(); base += batch) {
+    for(uint32_t i = 0; i < batch; ++i) {
+      uint64_t t = suite.OpBegin(ops++);
+      ptrs[i] = api.Malloc(sizes[base+i]);
+      Touch(ptrs[i]);
+      suite.OpEnd(t);
+    }
+    for(uint32_t n = 0; n < batch; ++n) {
+      uint32_t i = lifo ? batch - 1 - n : n;
+      uint64_t t = suite.OpBegin(ops++);
+      api.Free(ptrs[i]);
+      suite.OpEnd(t);
+    }
+  }
+  uint64_t ns = suite.Stop();
+  suite.Add(name, api.Name(), ops, ns);
+}
+
+template<typename API>
+void RunStream(API& api, Suite& suite, const char* name, const std::vector<uint32_t>& sizes, uint32_t window) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  std::vector<void*> ring(window);
+  for(uint32_t i = 0; i < window; ++i) {
+    ring[i] = api.Malloc(sizes[i]);
+    Touch(ring[i]);
+  }
+
+  suite.Start();
+  for(size_t i = window; i < sizes.size(); ++i) {
+    uint64_t t = suite.OpBegin(i);
+    void*& oldest = ring[i % window];
+    api.Free(oldest);
+    oldest = api.Malloc(sizes[i]);
+    Touch(oldest);
+    suite.OpEnd(t);
+  }
+  uint64_t ns = suite.Stop();
+
+  for(size_t i = sizes.size(); i < sizes.size() + window; ++i) {
+    api.Free(ring[i % window]);
+  }
+  suite.Add(name, api.Name(), sizes.size() - window, ns);
+}
+
+template<typename API>
+void RunStreams(API& api, Suite& suite, double scale) {
+  const uint64_t ops = static_cast<uint64_t>(200000 * scale);
+  std::vector<uint32_t> fixed(ops + 256, 64);
+  RunStream(api, suite, "stream/fixed-64", fixed, 256);
+  RunStream(api, suite, "stream/random-16-1024", MakeChurn(0, ops + 256, 16, 1024, false).Sizes, 256);
+}
+
+// BeginFrame for the engines that have one; the rest Free instead.
+template<typename API>
+void BeginFrame(API&) {}
+
+template<uint32_t SIZE, uint32_t N>
+void BeginFrame(xo::bench::FrameApi<SIZE, N>& api) { api.BeginFrame(); }
+
+template<typename API>
+void RunFrames(API& api, Suite& suite, const char* name, const std::vector<uint32_t>& sizes, uint32_t perFrame) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  std::vector<void*> frames[2];
+  uint64_t frame = 0;
+
+  suite.Start();
+  for(size_t base = 0; base + perFrame <= sizes.size(); base += perFrame, ++frame) {
+    // the frame before last is done with; last frame's is still in use.
+    BeginFrame(api);
+    std::vector<void*>& ptrs = frames[frame % 2];
+    for(void* m : ptrs) {
+      api.Free(m);
+    }
+    ptrs.clear();
+    for(uint32_t i = 0; i < perFrame; ++i) {
+      uint64_t t = suite.OpBegin(base + i);
+      void* m = api.Malloc(sizes[base+i]);
+      Touch(m);
+      suite.OpEnd(t);
+      ptrs.push_back(m);
+    }
+  }
+  uint64_t ns = suite.Stop();
+
+  for(std::vector<void*>& ptrs : frames) {
+    for(void* m : ptrs) {
+      api.Free(m);
+    }
+  }
+  suite.Add(name, api.Name(), frame * perFrame, ns);
+}
+
+template<typename API>
+void RunFrameSet(API& api, Suite& suite, double scale) {
+  const uint64_t ops = static_cast<uint64_t>(200000 * scale);
+  RunFrames(api, suite, "frame/random-16-256", MakeChurn(0, ops, 16, 256, false).Sizes, 1000);
+}
+
+template<typename API>
+void RunFill(API& api, Suite& suite, const char* name, uint32_t size, uint32_t rounds) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  std::vector<void*> ptrs;
+  ptrs.reserve(ArenaSize / size);
+  uint64_t ops = 0;
+  uint64_t ns = 0;
+
+  for(uint32_t r = 0; r < rounds; ++r) {
+    api.Reset();
+    ptrs.clear();
+    suite.Start();
+    for(uint64_t total = 0; total + size <= ArenaSize; total += size) {
+      uint64_t t = suite.OpBegin(ops);
+      void* m = api.Malloc(size);
+      suite.OpEnd(t);
+      if(!m) {
+        break;
+      }
+      ops++;
+      Touch(m);
+      ptrs.push_back(m);
+    }
+    for(void* m : ptrs) {
+      uint64_t t = suite.OpBegin(ops++);
+      api.Free(m);
+      suite.OpEnd(t);
+    }
+    ns += suite.Stop();
+  }
+  suite.Add(name, api.Name(), ops, ns);
+}
+
+template<typename API>
+void RunNewDelete(API& api, Suite& suite, const char* name, uint32_t live, const std::vector<uint32_t>& slots) {
+  if(!suite.Wants(name)) {
+    return;
+  }
+  api.Reset();
+  std::vector<Widget*> ptrs(live);
+  for(uint32_t i = 0; i < live; ++i) {
+    ptrs[i] = api.template New<Widget>("widget", static_cast<int>(i));
+  }
+
+  suite.Start();
+  for(size_t i = 0; i < slots.size(); ++i) {
+    uint64_t t = suite.OpBegin(i);
+    Widget*& slot = ptrs[slots[i]];
+    api.Delete(slot);
+    slot = api.template New<Widget>("widget", static_cast<int>(i));
+    suite.OpEnd(t);
+  }
+  uint64_t ns = suite.Stop();
+
+  for(Widget* w : ptrs) {
+    api.Delete(w);
+  }
+  suite.Add(name, api.Name(), slots.size(), ns);
+}
+
+template<typename API>
+void RunAll(API& api, Suite& suite, double scale) {
+  const uint32_t live = 1024;
+  const uint64_t ops = static_cast<uint64_t>(200000 * scale);
+
+  RunChurn(api, suite, "churn/fixed-16", MakeChurn(live, ops, 16, 16, false));
+  RunChurn(api, suite, "churn/fixed-64", MakeChurn(live, ops, 64, 64, false));
+  RunChurn(api, suite, "churn/fixed-256", MakeChurn(live, ops, 256, 256, false));
+  RunChurn(api, suite, "churn/random-8-1024", MakeChurn(live, ops, 8, 1024, false));
+  RunChurn(api, suite, "churn/random-log-16-16384", MakeChurn(live, ops, 16, 16384, true));
+
+  Churn sizes = MakeChurn(0, ops, 8, 1024, false);
+  std::vector<uint32_t> fixed(ops, 64);
+  RunOrder(api, suite, "order/lifo-64", fixed, 4096, true);
+  RunOrder(api, suite, "order/fifo-64", fixed, 4096, false);
+  RunOrder(api, suite, "order/lifo-random-8-1024", sizes.Sizes, 4096, true);
+  RunOrder(api, suite, "order/fifo-random-8-1024", sizes.Sizes, 4096, false);
+
+  uint32_t rounds = static_cast<uint32_t>(4 * scale) ? static_cast<uint32_t>(4 * scale) : 1;
+  RunStreams(api, suite, scale);
+  RunFrameSet(api, suite, scale);
+
+  RunFill(api, suite, "fill/1024", 1024, rounds);
+  RunFill(api, suite, "fill/4096", 4096, rounds);
+
+  RunNewDelete(api, suite, "new-delete/widget", live, MakeChurn(live, ops, 1, 1, false).Slots);
+}
+
+void Usage() {
+  fprintf(stderr,
+    "usage: bench [--filter text] [--engine name]... [--scale x] [--trials n]\n"
+    "             [--json results.json] [--baseline baseline.json] [--threshold x]\n");
+}
+
+bool WantsEngine(const std::vector<const char*>& engines, const char* name) {
+  if(engines.empty()) {
+    return true;
+  }
+  for(const char* e : engines) {
+    if(strcmp(e, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* filter = nullptr;
+  const char* json = nullptr;
+  const char* baselinePath = nullptr;
+  std::vector<const char*> engines;
+  double scale = 1.0;
+  double threshold = 0.1;
+  int trials = 1;
+
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+      filter = argv[++i];
+    } else if(strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+      engines.push_back(argv[++i]);
+    } else if(strcmp(argv[i], "--scale") == 0 && i+1 < argc) {
+      scale = atof(argv[++i]);
+    } else if(strcmp(argv[i], "--trials") == 0 && i+1 < argc) {
+      trials = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+      json = argv[++i];
+    } else if(strcmp(argv[i], "--baseline") == 0 && i+1 < argc) {
+      baselinePath = argv[++i];
+    } else if(strcmp(argv[i], "--threshold") == 0 && i+1 < argc) {
+      threshold = atof(argv[++i]);
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(scale <= 0.0 || trials < 1 || threshold < 0.0) {
+    Usage();
+    return 1;
+  }
+
+  // read it first, so a bad path fails before minutes of benchmarks.
+  xo::bench::Baseline baseline;
+  if(baselinePath && !xo::bench::ReadBaseline(baselinePath, &baseline)) {
+    fprintf(stderr, "Couldn't read baseline \"%s\".\n", baselinePath);
+    return 1;
+  }
+
+  Suite suite(filter);
+  suite.Setting("scale", scale);
+  suite.Setting("trials", trials);
+  const char* dlNames[] = { "jemalloc", "tcmalloc", "mimalloc" };
+
+  // trials of different engines interleave, so drift on the machine
+  // (thermals, other load) is spread across all of them.
+  for(int t = 0; t < trials; ++t) {
+    xo::bench::MallocApi mallocApi;
+    if(WantsEngine(engines, mallocApi.Name())) {
+      RunAll(mallocApi, suite, scale);
+    }
+
+    for(const char* name : dlNames) {
+      xo::bench::DlApi dl;
+      if(!WantsEngine(engines, name)) {
+        continue;
+      }
+      if(xo::bench::LoadDlMalloc(name, &dl.Fns)) {
+        RunAll(dl, suite, scale);
+      } else if(t == 0) {
+        printf("%s not found, skipping.\n", name);
+      }
+    }
+
+    xo::bench::BlockApi<ArenaSize> blockApi("block-16m");
+    if(WantsEngine(engines, blockApi.Name())) {
+      RunAll(blockApi, suite, scale);
+    }
+
+    xo::bench::BlockApi<ArenaSize, SmallClasses> classesApi("block-16m+classes");
+    if(WantsEngine(engines, classesApi.Name())) {
+      RunAll(classesApi, suite, scale);
+    }
+
+    xo::bench::RingApi<1u << 20> ringApi("ring-1m");
+    if(WantsEngine(engines, ringApi.Name())) {
+      RunStreams(ringApi, suite, scale);
+      RunFrameSet(ringApi, suite, scale);
+    }
+
+    xo::bench::FrameApi<1u << 20, 2> frameApi("frame-1m");
+    if(WantsEngine(engines, frameApi.Name())) {
+      RunFrameSet(frameApi, suite, scale);
+    }
+  }
+
+  if(json && !suite.WriteJson(json)) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", json);
+    return 1;
+  }
+  if(baselinePath && xo::bench::CompareToBaseline(suite, baseline, threshold, stdout) > 0) {
+    return 2;
+  }
+  return 0;
+}
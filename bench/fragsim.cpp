@@ -0,0 +1,418 @@
+//////////////////////////////////////////////////////////////////////
+//
+// fragsim.cpp
+//
+// Long running fragmentation simulator. Allocates one block per step
+// with sizes and lifetimes drawn from a distribution, frees blocks as
+// their lifetimes end, and samples how the free space of each engine
+// holds up over time.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/fragsim.cpp -o fragsim -ldl
+//
+// USAGE:
+//   fragsim [-e engine]... [--steps n] [--sizes dist] [--lifetimes dist]
+//           [--fill f] [--sample n] [--seed n] [--hints] [--csv out.csv]
+//           [--plot out.gp]
+//
+//   -e           engine to simulate; repeat for several. Default
+//                block-64k and block-1m. See xo-bench.h for names.
+//   --steps      allocations to simulate (default 1000000).
+//   --sizes      uniform:lo:hi      every size equally likely
+//                log:lo:hi          every power of two range equally
+//                                   likely, so small sizes dominate
+//                bimodal:a:b:p      size a, or size b with probability p
+//                trace:file         the allocation sizes in a trace
+//                (default log:16:4096)
+//   --lifetimes  exp               exponential around the mean
+//                mixed:p:r          fraction p of blocks live r times
+//                                   longer than the rest. This is the
+//                                   pattern that strands long lived
+//                                   blocks in freed space.
+//                (default mixed:0.1:50)
+//   --hints      run each engine again as "<engine>+hints", passing
+//                LifetimeLong for blocks from the long component of a
+//                mixed lifetime distribution.
+//   --fill       target share of the engine's arena to keep live. The
+//                mean lifetime is derived from it (default 0.5).
+//   --csv        write every sample: engine, step, live bytes, free
+//                bytes, largest free block, fragmentation and the
+//                allocation success rate since the previous sample.
+//   --plot       write a gnuplot script that plots the csv over time.
+//                Run it with: gnuplot out.gp (writes out.gp.png).
+//
+// SUMMARY (one row per engine):
+//   success      share of all allocations that succeeded.
+//   frag fails   failed allocations where the engine had enough free
+//                bytes in total, just not in one piece.
+//   frag mean    mean of BlockStats::Fragmentation() over samples.
+//   min largest  smallest "largest free block" seen at any sample.
+//   short stride mean distance in bytes between consecutive short lived
+//                allocations. Smaller means the working set of short
+//                lived blocks is packed closer together.
+//
+//////////////////////////////////////////////////////////////////////
+#define XO_ALLOC_TRACE
+#include "xo-bench.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using xo::bench::Engine;
+using xo::bench::Rng;
+
+namespace {
+
+// Engines without an arena size get this much "capacity" for --fill.
+static const uint64_t DefaultCapacity = 16u << 20;
+
+////////////////////////////////////////////////////////////////////// Distributions
+
+struct SizeDist {
+  enum Kind { Uniform, Log, Bimodal, Trace } Type;
+  uint32_t A;
+  uint32_t B;
+  double P;
+  std::vector<uint32_t> Samples;
+
+  uint32_t Next(Rng& rng) const {
+    switch(Type) {
+    case Uniform:
+      return rng.Range(A, B);
+    case Log: {
+      uint32_t buckets = 0;
+      // 64 bit, so doubling near the top of uint32_t doesn't wrap.
+      while((uint64_t(A) << (buckets+1)) <= B) {
+        ++buckets;
+      }
+      uint32_t lo = A << rng.Range(0, buckets);
+      uint64_t hi = uint64_t(lo)*2-1;
+      return rng.Range(lo, hi < B ? uint32_t(hi) : B);
+    }
+    case Bimodal:
+      return rng.Next() % 1000000 < uint64_t(P * 1000000) ? B : A;
+    case Trace:
+      return Samples[rng.Next() % Samples.size()];
+    }
+    return A;
+  }
+
+  double Mean() const {
+    Rng rng(7);
+    double sum = 0.0;
+    for(int i = 0; i < 100000; ++i) {
+      sum += Next(rng);
+    }
+    return sum / 100000.0;
+  }
+};
+
+bool ParseSizes(const char* spec, SizeDist* d) {
+  unsigned a = 0, b = 0;
+  double p = 0.0;
+  d->P = 0.0;
+  if(sscanf(spec, "uniform:%u:%u", &a, &b) == 2 && a && a <= b) {
+    d->Type = SizeDist::Uniform;
+  } else if(sscanf(spec, "log:%u:%u", &a, &b) == 2 && a && a <= b) {
+    d->Type = SizeDist::Log;
+  } else if(sscanf(spec, "bimodal:%u:%u:%lf", &a, &b, &p) == 3 && a && b && p >= 0.0 && p <= 1.0) {
+    d->Type = SizeDist::Bimodal;
+    d->P = p;
+  } else if(strncmp(spec, "trace:", 6) == 0) {
+    d->Type = SizeDist::Trace;
+    FILE* f = fopen(spec+6, "rb");
+    if(!f || !xo::ReadTraceHeader(f)) {
+      if(f) {
+        fclose(f);
+      }
+      return false;
+    }
+    xo::TraceRecord r;
+    while(xo::ReadTraceRecord(f, &r)) {
+      if((r.Op == xo::TraceMalloc || r.Op == xo::TraceNew) && r.Size) {
+        d->Samples.push_back(r.Size);
+      }
+    }
+    fclose(f);
+    return !d->Samples.empty();
+  } else {
+    return false;
+  }
+  d->A = a;
+  d->B = b;
+  return true;
+}
+
+struct LifetimeDist {
+  double LongShare;  // 0 for plain exponential
+  double LongRatio;
+
+  // mean is the overall mean lifetime in steps. isLong is set when the
+  // block came from the long lived share.
+  uint64_t Next(Rng& rng, double mean, bool* isLong) const {
+    // pick the short mean so the mixture still averages to mean.
+    double shortMean = mean / (1.0 - LongShare + LongShare * LongRatio);
+    *isLong = rng.Next() % 1000000 < uint64_t(LongShare * 1000000);
+    double m = *isLong ? shortMean * LongRatio : shortMean;
+    double u = (double(rng.Next() >> 11) + 0.5) / double(1ull << 53);
+    return static_cast<uint64_t>(-log(u) * m) + 1;
+  }
+};
+
+bool ParseLifetimes(const char* spec, LifetimeDist* d) {
+  if(strcmp(spec, "exp") == 0) {
+    d->LongShare = 0.0;
+    d->LongRatio = 1.0;
+    return true;
+  }
+  return sscanf(spec, "mixed:%lf:%lf", &d->LongShare, &d->LongRatio) == 2 &&
+    d->LongShare >= 0.0 && d->LongShare < 1.0 && d->LongRatio >= 1.0;
+}
+
+////////////////////////////////////////////////////////////////////// Simulation
+
+struct Summary {
+  uint64_t Allocs;
+  uint64_t Failures;
+  uint64_t FragFailures;
+  double FragSum;
+  uint64_t Samples;
+  uint32_t MinLargest;
+  uint64_t StrideSum;
+  uint64_t Strides;
+};
+
+struct Options {
+  uint64_t Steps;
+  uint64_t SampleEvery;
+  uint64_t Seed;
+  double Fill;
+  bool Hints;
+  SizeDist Sizes;
+  LifetimeDist Lifetimes;
+  FILE* Csv;
+};
+
+uint64_t Capacity(const char* engine) {
+#define XO_FRAGSIM_CAPACITY(n, s) if(strcmp(engine, n) == 0) { return s; }
+  XO_BENCH_BLOCK_SIZES(XO_FRAGSIM_CAPACITY)
+#undef XO_FRAGSIM_CAPACITY
+  return DefaultCapacity;
+}
+
+void Simulate(Engine* engine, const char* label, bool hints, const Options& opt, Summary* sum) {
+  typedef std::pair<uint64_t, std::pair<void*, uint32_t> > Death; // step, block, size
+  std::priority_queue<Death, std::vector<Death>, std::greater<Death> > deaths;
+
+  Rng rng(opt.Seed);
+  double meanSize = opt.Sizes.Mean();
+  double meanLifetime = opt.Fill * double(Capacity(engine->Name())) / meanSize;
+  uint64_t live = 0;
+  uint64_t windowAllocs = 0;
+  uint64_t windowFailures = 0;
+  xo::BlockStats stats;
+  const char* lastShort = nullptr;
+
+  for(uint64_t step = 1; step <= opt.Steps; ++step) {
+    while(!deaths.empty() && deaths.top().first <= step) {
+      engine->Free(deaths.top().second.first);
+      live -= deaths.top().second.second;
+      deaths.pop();
+    }
+
+    uint32_t size = opt.Sizes.Next(rng);
+    bool isLong = false;
+    uint64_t lifetime = opt.Lifetimes.Next(rng, meanLifetime, &isLong);
+    ++sum->Allocs;
+    ++windowAllocs;
+    xo::Lifetime hint = hints && isLong ? xo::LifetimeLong : xo::LifetimeShort;
+    if(void* m = engine->MallocHinted(size, hint)) {
+      *static_cast<volatile char*>(m) = 1;
+      if(!isLong) {
+        const char* c = static_cast<const char*>(m);
+        if(lastShort) {
+          sum->StrideSum += c > lastShort ? c - lastShort : lastShort - c;
+          sum->Strides++;
+        }
+        lastShort = c;
+      }
+      deaths.push(Death(step + lifetime, std::make_pair(m, size)));
+      live += size;
+    } else {
+      ++sum->Failures;
+      ++windowFailures;
+      if(engine->Stats(&stats) && stats.FreeBytes >= size) {
+        ++sum->FragFailures;
+      }
+    }
+
+    if(step % opt.SampleEvery == 0 && engine->Stats(&stats)) {
+      float frag = stats.Fragmentation();
+      sum->FragSum += frag;
+      sum->Samples++;
+      if(stats.LargestFree < sum->MinLargest) {
+        sum->MinLargest = stats.LargestFree;
+      }
+      if(opt.Csv) {
+        fprintf(opt.Csv, "%s,%llu,%llu,%u,%u,%.4f,%.4f\n", label,
+          static_cast<unsigned long long>(step), static_cast<unsigned long long>(live),
+          stats.FreeBytes, stats.LargestFree, frag,
+          1.0 - double(windowFailures) / double(windowAllocs));
+      }
+      windowAllocs = 0;
+      windowFailures = 0;
+    }
+  }
+
+  while(!deaths.empty()) {
+    engine->Free(deaths.top().second.first);
+    deaths.pop();
+  }
+}
+
+bool WritePlot(const char* path, const char* csv, const std::vector<std::string>& engines) {
+  FILE* f = fopen(path, "w");
+  if(!f) {
+    return false;
+  }
+  fprintf(f, "# fragsim plot. run: gnuplot %s\n", path);
+  fprintf(f, "set terminal pngcairo size 1200,900\nset output '%s.png'\n", path);
+  fprintf(f, "set datafile separator ','\nset multiplot layout 3,1\nset xlabel 'step'\nset key outside\n");
+  struct Panel { const char* Title; int Column; };
+  const Panel panels[] = {
+    { "fragmentation (1 - largest free / free)", 6 },
+    { "largest free block (bytes)", 5 },
+    { "allocation success rate", 7 },
+  };
+  for(const Panel& p : panels) {
+    fprintf(f, "set title '%s'\nplot ", p.Title);
+    for(size_t i = 0; i < engines.size(); ++i) {
+      fprintf(f, "%s'%s' using 2:(strcol(1) eq '%s' ? $%d : 1/0) with lines title '%s'",
+        i ? ", " : "", csv, engines[i].c_str(), p.Column, engines[i].c_str());
+    }
+    fprintf(f, "\n");
+  }
+  fprintf(f, "unset multiplot\n");
+  return fclose(f) == 0;
+}
+
+void Usage() {
+  fprintf(stderr,
+    "usage: fragsim [-e engine]... [--steps n] [--sizes dist] [--lifetimes dist]\n"
+    "               [--fill f] [--sample n] [--seed n] [--hints] [--csv out.csv]\n"
+    "               [--plot out.gp]\n"
+    "engines:\n");
+  xo::bench::PrintEngineNames(stderr);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::vector<const char*> engines;
+  const char* csvPath = nullptr;
+  const char* plotPath = nullptr;
+  Options opt;
+  opt.Steps = 1000000;
+  opt.SampleEvery = 1000;
+  opt.Seed = 1;
+  opt.Fill = 0.5;
+  opt.Hints = false;
+  opt.Csv = nullptr;
+  ParseSizes("log:16:4096", &opt.Sizes);
+  ParseLifetimes("mixed:0.1:50", &opt.Lifetimes);
+
+  for(int i = 1; i < argc; ++i) {
+    bool more = i+1 < argc;
+    if(strcmp(argv[i], "-e") == 0 && more) {
+      engines.push_back(argv[++i]);
+    } else if(strcmp(argv[i], "--steps") == 0 && more) {
+      opt.Steps = strtoull(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--sample") == 0 && more) {
+      opt.SampleEvery = strtoull(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--seed") == 0 && more) {
+      opt.Seed = strtoull(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--fill") == 0 && more) {
+      opt.Fill = atof(argv[++i]);
+    } else if(strcmp(argv[i], "--sizes") == 0 && more) {
+      if(!ParseSizes(argv[++i], &opt.Sizes)) {
+        fprintf(stderr, "Bad size distribution \"%s\".\n", argv[i]);
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--lifetimes") == 0 && more) {
+      if(!ParseLifetimes(argv[++i], &opt.Lifetimes)) {
+        fprintf(stderr, "Bad lifetime distribution \"%s\".\n", argv[i]);
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--hints") == 0) {
+      opt.Hints = true;
+    } else if(strcmp(argv[i], "--csv") == 0 && more) {
+      csvPath = argv[++i];
+    } else if(strcmp(argv[i], "--plot") == 0 && more) {
+      plotPath = argv[++i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(opt.SampleEvery == 0 || opt.Fill <= 0.0 || (plotPath && !csvPath)) {
+    Usage();
+    return 1;
+  }
+  if(engines.empty()) {
+    engines.push_back("block-64k");
+    engines.push_back("block-1m");
+  }
+  if(csvPath) {
+    opt.Csv = fopen(csvPath, "w");
+    if(!opt.Csv) {
+      fprintf(stderr, "Couldn't write \"%s\".\n", csvPath);
+      return 1;
+    }
+    fprintf(opt.Csv, "engine,step,live_bytes,free_bytes,largest_free,fragmentation,success_rate\n");
+  }
+
+  printf("%-16s %12s %10s %12s %10s %12s %12s\n", "engine", "allocs", "success", "frag fails", "frag mean",
+    "min largest", "short stride");
+  std::vector<std::string> labels;
+  for(const char* name : engines) {
+    for(int hints = 0; hints <= (opt.Hints ? 1 : 0); ++hints) {
+      Engine* engine = xo::bench::CreateEngine(name);
+      if(!engine) {
+        fprintf(stderr, "Unknown engine \"%s\".\n", name);
+        Usage();
+        return 1;
+      }
+      labels.push_back(std::string(name) + (hints ? "+hints" : ""));
+      Summary sum = {};
+      sum.MinLargest = UINT32_MAX;
+      Simulate(engine, labels.back().c_str(), hints != 0, opt, &sum);
+      delete engine;
+
+      printf("%-16s %12llu %9.3f%% %12llu %10.3f %12u %12.0f\n", labels.back().c_str(),
+        static_cast<unsigned long long>(sum.Allocs),
+        sum.Allocs ? 100.0 * double(sum.Allocs - sum.Failures) / double(sum.Allocs) : 0.0,
+        static_cast<unsigned long long>(sum.FragFailures),
+        sum.Samples ? sum.FragSum / double(sum.Samples) : 0.0,
+        sum.Samples ? sum.MinLargest : 0,
+        sum.Strides ? double(sum.StrideSum) / double(sum.Strides) : 0.0);
+      fflush(stdout);
+    }
+  }
+
+  if(opt.Csv) {
+    fclose(opt.Csv);
+  }
+  if(plotPath && !WritePlot(plotPath, csvPath, labels)) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", plotPath);
+    return 1;
+  }
+  return 0;
+}
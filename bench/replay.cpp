@@ -0,0 +1,252 @@
+//////////////////////////////////////////////////////////////////////
+//
+// replay.cpp
+//
+// Plays an xo-alloc trace (see TraceRecorder in xo-alloc.h) back against
+// one or more allocators and reports how each one copes with the
+// recorded workload.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/replay.cpp -o replay
+//
+// USAGE:
+//   replay [-e engine]... [-s sample_every] [--ignore-hints] trace.xotrace
+//
+//   With no -e, replays against malloc and block-256m. Lifetime hints
+//   recorded in the trace are passed on unless --ignore-hints is given,
+//   so running with and without it shows what the hints are worth.
+//
+// ENGINES:
+//   Only the general purpose ones: malloc, jemalloc, tcmalloc and
+//   mimalloc where they load, and block-<size> (BlockAllocator). A
+//   trace can free in any order and ask for any size, which the pool,
+//   ring, linear, double stack and child allocators don't take, so a
+//   trace recorded from one of those is replayed as a general workload
+//   against these. The usage message lists them.
+//
+// OUTPUT (one row per engine):
+//   Mops/s       allocs+frees per second. Timed on a pass with no
+//                measurement hooks.
+//   failed       allocations that returned nullptr during replay.
+//   peak live    most bytes the trace ever had allocated at once.
+//   footprint    most memory the engine held at once (see xo-bench.h).
+//   frag@peak    BlockStats::Fragmentation() at the last sample taken
+//                while live bytes were at their peak.
+//   frag max     worst fragmentation seen at any sample.
+//
+//////////////////////////////////////////////////////////////////////
+#define XO_ALLOC_TRACE
+#include "xo-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using xo::bench::Engine;
+using xo::TraceRecord;
+
+namespace {
+
+struct Result {
+  double Seconds;
+  uint64_t Ops;
+  uint64_t Failed;
+  uint64_t PeakLive;
+  size_t PeakFootprint;
+  float FragAtPeak;
+  float FragMax;
+};
+
+bool IgnoreHints = false;
+
+bool IsAlloc(const TraceRecord& r) {
+  return r.Op == xo::TraceMalloc || r.Op == xo::TraceNew;
+}
+
+// Allocations that failed when the trace was recorded have no id, so
+// nothing can ever free them. Skip them rather than leak.
+bool Skip(const TraceRecord& r) {
+  return (r.Flags & xo::TraceFailed) != 0;
+}
+
+void* Allocate(Engine* engine, const TraceRecord& r) {
+  return engine->MallocHinted(r.Size, IgnoreHints ? xo::LifetimeShort : xo::TraceLifetime(r.Flags));
+}
+
+double Timed(Engine* engine, const std::vector<TraceRecord>& trace, std::vector<void*>& ptrs) {
+  uint64_t start = xo::bench::NowNs();
+  for(const TraceRecord& r : trace) {
+    if(Skip(r)) {
+      continue;
+    }
+    if(IsAlloc(r)) {
+      ptrs[r.Id] = Allocate(engine, r);
+    } else if(void* m = ptrs[r.Id]) {
+      engine->Free(m);
+      ptrs[r.Id] = nullptr;
+    }
+  }
+  double seconds = double(xo::bench::NowNs() - start) / 1e9;
+
+  for(void*& m : ptrs) {
+    if(m) {
+      engine->Free(m);
+      m = nullptr;
+    }
+  }
+  return seconds;
+}
+
+void Measured(Engine* engine, const std::vector<TraceRecord>& trace, std::vector<void*>& ptrs,
+  uint32_t sampleEvery, Result* res) {
+  std::vector<uint32_t> sizes(ptrs.size(), 0);
+  size_t baseFootprint = engine->Footprint();
+  uint64_t live = 0;
+  uint64_t ops = 0;
+  xo::BlockStats stats;
+
+  for(const TraceRecord& r : trace) {
+    if(Skip(r)) {
+      continue;
+    }
+    if(IsAlloc(r)) {
+      void* m = Allocate(engine, r);
+      ptrs[r.Id] = m;
+      if(!m) {
+        res->Failed++;
+      } else {
+        sizes[r.Id] = r.Size;
+        live += r.Size;
+        if(live > res->PeakLive) {
+          res->PeakLive = live;
+        }
+      }
+    } else if(void* m = ptrs[r.Id]) {
+      engine->Free(m);
+      ptrs[r.Id] = nullptr;
+      live -= sizes[r.Id];
+    }
+
+    ++ops;
+    if(ops % sampleEvery == 0) {
+      size_t footprint = engine->Footprint();
+      footprint = footprint > baseFootprint ? footprint - baseFootprint : 0;
+      if(footprint > res->PeakFootprint) {
+        res->PeakFootprint = footprint;
+      }
+      if(engine->Stats(&stats)) {
+        float frag = stats.Fragmentation();
+        if(live == res->PeakLive) {
+          res->FragAtPeak = frag;
+        }
+        if(frag > res->FragMax) {
+          res->FragMax = frag;
+        }
+      }
+    }
+  }
+  res->Ops = ops;
+
+  for(void*& m : ptrs) {
+    if(m) {
+      engine->Free(m);
+      m = nullptr;
+    }
+  }
+}
+
+void Usage() {
+  fprintf(stderr, "usage: replay [-e engine]... [-s sample_every] [--ignore-hints] trace.xotrace\nengines:\n");
+  xo::bench::PrintEngineNames(stderr);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::vector<const char*> engines;
+  const char* path = nullptr;
+  uint32_t sampleEvery = 1000;
+
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "-e") == 0 && i+1 < argc) {
+      engines.push_back(argv[++i]);
+    } else if(strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+      sampleEvery = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if(strcmp(argv[i], "--ignore-hints") == 0) {
+      IgnoreHints = true;
+    } else if(argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(!path || sampleEvery == 0) {
+    Usage();
+    return 1;
+  }
+  if(engines.empty()) {
+    engines.push_back("malloc");
+    engines.push_back("block-256m");
+  }
+
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    fprintf(stderr, "Couldn't open trace \"%s\".\n", path);
+    return 1;
+  }
+  if(!xo::ReadTraceHeader(f)) {
+    fprintf(stderr, "\"%s\" isn't an xo-alloc trace (or is a newer version).\n", path);
+    fclose(f);
+    return 1;
+  }
+  std::vector<TraceRecord> trace;
+  uint32_t maxId = 0;
+  uint64_t recordedFailures = 0;
+  TraceRecord r;
+  while(xo::ReadTraceRecord(f, &r)) {
+    trace.push_back(r);
+    if(r.Id > maxId) {
+      maxId = r.Id;
+    }
+    if(r.Flags & xo::TraceFailed) {
+      recordedFailures++;
+    }
+  }
+  fclose(f);
+
+  printf("trace: %s, %zu records, %u allocations, %llu failed when recorded\n\n",
+    path, trace.size(), maxId, static_cast<unsigned long long>(recordedFailures));
+  printf("%-12s %10s %10s %8s %14s %14s %10s %10s\n",
+    "engine", "ops", "Mops/s", "failed", "peak live", "footprint", "frag@peak", "frag max");
+
+  std::vector<void*> ptrs(maxId+1, nullptr);
+  for(const char* name : engines) {
+    Engine* engine = xo::bench::CreateEngine(name);
+    if(!engine) {
+      fprintf(stderr, "Unknown engine \"%s\".\n", name);
+      Usage();
+      return 1;
+    }
+    Result res = {};
+    res.Seconds = Timed(engine, trace, ptrs);
+    delete engine;
+
+    // measure on a fresh engine so the timed pass doesn't skew footprint.
+    engine = xo::bench::CreateEngine(name);
+    Measured(engine, trace, ptrs, sampleEvery, &res);
+    delete engine;
+
+    printf("%-12s %10llu %10.2f %8llu %14llu %14zu %10.3f %10.3f\n",
+      name,
+      static_cast<unsigned long long>(res.Ops),
+      res.Seconds > 0 ? double(res.Ops) / res.Seconds / 1e6 : 0.0,
+      static_cast<unsigned long long>(res.Failed),
+      static_cast<unsigned long long>(res.PeakLive),
+      res.PeakFootprint,
+      res.FragAtPeak,
+      res.FragMax);
+  }
+  return 0;
+}
@@ -0,0 +1,258 @@
+//////////////////////////////////////////////////////////////////////
+//
+// sizeclass-gen.cpp
+//
+// Picks BlockAllocator size classes for a workload. Reads the
+// allocation sizes from a trace (see TRACING in xo-alloc.h) or a plain
+// histogram, chooses the classes that waste the fewest bytes to
+// rounding, and writes them out as a header with a SizeClasses typedef.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 bench/sizeclass-gen.cpp -o sizeclass-gen
+//
+// USAGE:
+//   sizeclass-gen [-k classes] [--max bytes] [--name Type] [-o out.h]
+//                 (trace.xotrace | --hist histogram.txt)
+//
+//   -k       number of classes (default 8).
+//   --max    largest size worth a class (default 1024). Bigger
+//            allocations are left to the block list, and so is
+//            anything under 4 bytes, which is rounded up to 4.
+//   --name   name of the typedef (default WorkloadClasses).
+//   -o       header to write (default: stdout).
+//   --hist   read "size count" pairs, one per line, instead of a trace.
+//
+//   The classes minimise the bytes lost to rounding up, weighted by
+//   how often each size is allocated (a dynamic program over the
+//   distinct block sizes, which step by BlockCore::Align). A summary
+//   on stderr compares that waste with the same number of power of two
+//   classes.
+//
+//////////////////////////////////////////////////////////////////////
+#define XO_ALLOC_TRACE
+#include "../xo-alloc.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+typedef std::map<uint32_t, uint64_t> Histogram;
+
+bool ReadTrace(const char* path, Histogram* hist) {
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    return false;
+  }
+  if(!xo::ReadTraceHeader(f)) {
+    fclose(f);
+    return false;
+  }
+  xo::TraceRecord r;
+  while(xo::ReadTraceRecord(f, &r)) {
+    if((r.Op == xo::TraceMalloc || r.Op == xo::TraceNew) && !(r.Flags & xo::TraceFailed)) {
+      (*hist)[r.Size]++;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+bool ReadHist(const char* path, Histogram* hist) {
+  FILE* f = fopen(path, "r");
+  if(!f) {
+    return false;
+  }
+  unsigned size;
+  unsigned long long count;
+  while(fscanf(f, "%u %llu", &size, &count) == 2) {
+    (*hist)[size] += count;
+  }
+  fclose(f);
+  return true;
+}
+
+// Bytes lost rounding every size in hist up to the block its class
+// takes. Sizes above the last class aren't counted; they don't use one.
+uint64_t Waste(const Histogram& hist, const std::vector<uint32_t>& classes) {
+  uint64_t waste = 0;
+  for(const std::pair<const uint32_t, uint64_t>& h : hist) {
+    for(uint32_t c : classes) {
+      if(c >= h.first) {
+        waste += uint64_t(xo::BlockCore::Round(c) - h.first) * h.second;
+        break;
+      }
+    }
+  }
+  return waste;
+}
+
+// Best k classes for sizes/counts (ascending, distinct). The largest
+// size is always a class, or it couldn't be served.
+std::vector<uint32_t> Choose(const std::vector<uint32_t>& sizes, const std::vector<uint64_t>& counts, uint32_t k) {
+  size_t m = sizes.size();
+  if(k >= m) {
+    return sizes;
+  }
+  // prefix sums of counts and bytes, so the cost of one class serving
+  // sizes j..i is sizes[i] * count(j..i) - bytes(j..i).
+  std::vector<double> count(m + 1, 0.0), bytes(m + 1, 0.0);
+  for(size_t i = 0; i < m; ++i) {
+    count[i+1] = count[i] + double(counts[i]);
+    bytes[i+1] = bytes[i] + double(counts[i]) * sizes[i];
+  }
+  auto cost = [&](size_t j, size_t i) {
+    return double(sizes[i]) * (count[i+1] - count[j]) - (bytes[i+1] - bytes[j]);
+  };
+
+  // best[c][i]: least waste serving sizes 0..i with c+1 classes, the
+  // last one sizes[i]. from[c][i] is where that last class starts.
+  std::vector<std::vector<double> > best(k, std::vector<double>(m, 0.0));
+  std::vector<std::vector<uint32_t> > from(k, std::vector<uint32_t>(m, 0));
+  for(size_t i = 0; i < m; ++i) {
+    best[0][i] = cost(0, i);
+  }
+  for(uint32_t c = 1; c < k; ++c) {
+    for(size_t i = c; i < m; ++i) {
+      best[c][i] = best[c-1][i-1];
+      from[c][i] = static_cast<uint32_t>(i);
+      for(size_t j = c; j < i; ++j) {
+        double w = best[c-1][j-1] + cost(j, i);
+        if(w < best[c][i]) {
+          best[c][i] = w;
+          from[c][i] = static_cast<uint32_t>(j);
+        }
+      }
+    }
+  }
+
+  std::vector<uint32_t> classes(k);
+  size_t i = m - 1;
+  for(uint32_t c = k; c-- > 0;) {
+    classes[c] = sizes[i];
+    i = c ? from[c][i] - 1 : 0;
+  }
+  return classes;
+}
+
+std::vector<uint32_t> PowersOfTwo(uint32_t max, uint32_t k) {
+  std::vector<uint32_t> classes;
+  for(uint32_t c = 4; c < max && classes.size() + 1 < k; c *= 2) {
+    classes.push_back(c);
+  }
+  classes.push_back(max);
+  return classes;
+}
+
+void Usage() {
+  fprintf(stderr,
+    "usage: sizeclass-gen [-k classes] [--max bytes] [--name Type] [-o out.h]\n"
+    "                     (trace.xotrace | --hist histogram.txt)\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  const char* histPath = nullptr;
+  const char* outPath = nullptr;
+  const char* name = "WorkloadClasses";
+  uint32_t k = 8;
+  uint32_t max = 1024;
+
+  for(int i = 1; i < argc; ++i) {
+    bool more = i+1 < argc;
+    if(strcmp(argv[i], "-k") == 0 && more) {
+      k = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if(strcmp(argv[i], "--max") == 0 && more) {
+      max = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if(strcmp(argv[i], "--name") == 0 && more) {
+      name = argv[++i];
+    } else if(strcmp(argv[i], "-o") == 0 && more) {
+      outPath = argv[++i];
+    } else if(strcmp(argv[i], "--hist") == 0 && more) {
+      histPath = argv[++i];
+    } else if(argv[i][0] != '-' && !tracePath) {
+      tracePath = argv[i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if(!tracePath == !histPath || k == 0 || max < 4) {
+    Usage();
+    return 1;
+  }
+
+  Histogram all;
+  const char* input = tracePath ? tracePath : histPath;
+  if(!(tracePath ? ReadTrace(tracePath, &all) : ReadHist(histPath, &all))) {
+    fprintf(stderr, "Couldn't read \"%s\".\n", input);
+    return 1;
+  }
+
+  // classes hold their free list link, so nothing under 4 bytes.
+  Histogram hist;
+  uint64_t total = 0;
+  uint64_t covered = 0;
+  for(const std::pair<const uint32_t, uint64_t>& h : all) {
+    total += h.second;
+    if(h.first <= max) {
+      hist[h.first < 4 ? 4 : h.first] += h.second;
+      covered += h.second;
+    }
+  }
+  if(hist.empty()) {
+    fprintf(stderr, "No allocations of %u bytes or less in \"%s\".\n", max, input);
+    return 1;
+  }
+
+  // blocks come in Align steps, so sizes that round to the same block
+  // are one candidate: a class between them would save nothing.
+  std::vector<uint32_t> sizes;
+  std::vector<uint64_t> counts;
+  uint64_t requested = 0;
+  for(const std::pair<const uint32_t, uint64_t>& h : hist) {
+    uint32_t block = xo::BlockCore::Round(h.first);
+    if(sizes.empty() || sizes.back() != block) {
+      sizes.push_back(block);
+      counts.push_back(0);
+    }
+    counts.back() += h.second;
+    requested += uint64_t(h.first) * h.second;
+  }
+  std::vector<uint32_t> classes = Choose(sizes, counts, k);
+  std::vector<uint32_t> pow2 = PowersOfTwo(sizes.back(), k);
+  uint64_t waste = Waste(hist, classes);
+  uint64_t pow2Waste = Waste(hist, pow2);
+
+  FILE* out = outPath ? fopen(outPath, "w") : stdout;
+  if(!out) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", outPath);
+    return 1;
+  }
+  fprintf(out, "// Generated by sizeclass-gen from %s.\n", input);
+  fprintf(out, "// %llu of %llu allocations fit a class; rounding wastes %.2f%% of their bytes.\n",
+    static_cast<unsigned long long>(covered), static_cast<unsigned long long>(total),
+    100.0 * double(waste) / double(requested));
+  fprintf(out, "#pragma once\n\n#include \"xo-alloc.h\"\n\ntypedef xo::SizeClasses<");
+  for(size_t i = 0; i < classes.size(); ++i) {
+    fprintf(out, "%s%u", i ? ", " : "", classes[i]);
+  }
+  fprintf(out, "> %s;\n", name);
+  if(outPath && fclose(out) != 0) {
+    fprintf(stderr, "Couldn't write \"%s\".\n", outPath);
+    return 1;
+  }
+
+  fprintf(stderr, "%llu allocations, %llu of them %u bytes or less, %zu distinct sizes\n",
+    static_cast<unsigned long long>(total), static_cast<unsigned long long>(covered), max, hist.size());
+  fprintf(stderr, "waste: %.2f%% with these %zu classes, %.2f%% with %zu powers of two\n",
+    100.0 * double(waste) / double(requested), classes.size(),
+    100.0 * double(pow2Waste) / double(requested), pow2.size());
+  return 0;
+}
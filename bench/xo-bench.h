@@ -0,0 +1,1107 @@
+//////////////////////////////////////////////////////////////////////
+//
+// xo-bench.h
+//
+// Shared pieces of the xo-alloc benchmark tools in this directory.
+// Not part of the library; nothing here is needed to use xo-alloc.h.
+//
+// ENGINES:
+//   An Engine is one allocator behind a virtual Malloc/Free, so a tool
+//   can pick what to drive from the command line. The virtual call is
+//   the same for every engine, so comparisons between them stay fair.
+//
+//   malloc      the C runtime heap
+//   block-<N>   xo::BlockAllocator<N>, N one of the sizes in
+//               XO_BENCH_BLOCK_SIZES below (e.g. block-16m)
+//   jemalloc    }
+//   tcmalloc    } loaded with dlopen when installed on this machine,
+//   mimalloc    } skipped otherwise. Needs -ldl on older glibc.
+//
+// RESULTS:
+//   Suite collects one Result per benchmark/engine pair, prints them
+//   as a table and writes them as JSON so runs can be compared later:
+//
+//   { "version": 1, "host": "...", "compiler": "...", "time": "...",
+//     "results": [ { "benchmark": "churn/fixed-64", "engine": "malloc",
+//                    "ops": 1000000, "ns_per_op": 21.3 }, ... ] }
+//
+//   Benchmarks can attach extra numbers to a result with Metric(); they
+//   show up as more keys on that result's JSON object. Setting() adds a
+//   top level key for how the run was made ("scale", "trials").
+//
+// LATENCY:
+//   A benchmark that brackets each op with OpBegin/OpEnd gets one op
+//   in every LatencyEvery timed on its own. Each trial's samples become
+//   "p50_ns" and "p99_ns" on the result (medians over the trials), with
+//   "p99_min" and "p99_max". The sampling is inside the timed region,
+//   so it adds a couple of clock reads per LatencyEvery ops to ns_per_op.
+//
+// BASELINES:
+//   Running the same benchmark several times (trials) merges into one
+//   result whose ns_per_op is the median; "trials", "ns_min" and
+//   "ns_max" show the spread. A results file can be read back as a
+//   baseline with ReadBaseline and compared with CompareToBaseline.
+//
+//   The comparison uses the fastest trial, ns_min, which noise can only
+//   push up, and p99_min where both sides have latency samples. The
+//   slowdown allowed is the base threshold plus three times the
+//   baseline's own trial spread, measured as median / fastest - 1
+//   (ns_per_op over ns_min, p99_ns over p99_min), so a noisy benchmark
+//   gets the room its noise needs. The spread uses the median rather
+//   than the slowest trial, so one disturbed trial doesn't open the
+//   gate wide. The base threshold is the entry's "threshold" key if it
+//   has one, the caller's default otherwise. A baseline from another
+//   host, or made with other settings, is compared anyway, with a
+//   warning.
+//
+// COUNTERS:
+//   On Linux, Suite::Start/Stop also read hardware counters through
+//   perf_event_open: cycles, instructions, L1D read misses, LLC misses,
+//   dTLB read misses and branch misses. Each is attached to the result
+//   per op ("cycles_per_op", ...). A counter the kernel, the CPU or
+//   perf_event_paranoid won't give us is left out; if none open, the
+//   results are plain timings. Only user space is counted, so
+//   perf_event_paranoid <= 2 is enough.
+//
+//////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "../xo-alloc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <unistd.h>
+#define XO_BENCH_DLOPEN 1
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define XO_BENCH_PERF 1
+#endif
+
+namespace xo {
+namespace bench {
+
+inline uint64_t NowNs() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Resident set size of the whole process, or 0 where we can't tell.
+inline size_t ResidentBytes() {
+#if defined(__linux__)
+  size_t pages = 0;
+  size_t resident = 0;
+  if(FILE* f = fopen("/proc/self/statm", "r")) {
+    if(fscanf(f, "%zu %zu", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+// xorshift64*. Deterministic across platforms, unlike rand().
+class Rng {
+public:
+  explicit Rng(uint64_t seed = 0x2545F4914F6CDD1Dull) : m_State(seed ? seed : 1) {}
+
+  uint64_t Next() {
+    m_State ^= m_State >> 12;
+    m_State ^= m_State << 25;
+    m_State ^= m_State >> 27;
+    return m_State * 0x2545F4914F6CDD1Dull;
+  }
+
+  // [lo, hi]
+  uint32_t Range(uint32_t lo, uint32_t hi) {
+    return lo + static_cast<uint32_t>(Next() % (uint64_t(hi) - lo + 1));
+  }
+
+private:
+  uint64_t m_State;
+};
+
+////////////////////////////////////////////////////////////////////// DlMalloc
+
+// A third party malloc found at runtime. Functions are null if it wasn't.
+struct DlMalloc {
+  const char* Name;
+  void* (*Malloc)(size_t);
+  void (*Free)(void*);
+};
+
+// name is one of "jemalloc", "tcmalloc" or "mimalloc".
+inline bool LoadDlMalloc(const char* name, DlMalloc* out) {
+  struct Candidate { const char* Name; const char* Lib; const char* Malloc; const char* Free; };
+  // jemalloc's public malloc/free are looked up through its own handle,
+  // so we get its definitions and not the ones already in the process.
+  static const Candidate candidates[] = {
+    { "jemalloc", "libjemalloc.so.2",         "malloc",    "free" },
+    { "jemalloc", "libjemalloc.so",           "malloc",    "free" },
+    { "jemalloc", "libjemalloc.2.dylib",      "malloc",    "free" },
+    { "tcmalloc", "libtcmalloc_minimal.so.4", "tc_malloc", "tc_free" },
+    { "tcmalloc", "libtcmalloc.so.4",         "tc_malloc", "tc_free" },
+    { "tcmalloc", "libtcmalloc_minimal.dylib","tc_malloc", "tc_free" },
+    { "mimalloc", "libmimalloc.so.2",         "mi_malloc", "mi_free" },
+    { "mimalloc", "libmimalloc.so",           "mi_malloc", "mi_free" },
+    { "mimalloc", "libmimalloc.dylib",        "mi_malloc", "mi_free" },
+  };
+  out->Name = name;
+  out->Malloc = nullptr;
+  out->Free = nullptr;
+#if defined(XO_BENCH_DLOPEN)
+  for(const Candidate& c : candidates) {
+    if(strcmp(c.Name, name) != 0) {
+      continue;
+    }
+    // never dlclosed. allocators don't like being unloaded.
+    if(void* lib = dlopen(c.Lib, RTLD_NOW | RTLD_LOCAL)) {
+      out->Malloc = reinterpret_cast<void*(*)(size_t)>(dlsym(lib, c.Malloc));
+      out->Free = reinterpret_cast<void(*)(void*)>(dlsym(lib, c.Free));
+      if(out->Malloc && out->Free) {
+        return true;
+      }
+      out->Malloc = nullptr;
+      out->Free = nullptr;
+    }
+  }
+#else
+  (void)candidates;
+#endif
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////// Engine
+
+class Engine {
+public:
+  virtual ~Engine() {}
+  virtual const char* Name() const = 0;
+  virtual void* Malloc(size_t size) = 0;
+  virtual void Free(void* m) = 0;
+
+  // Malloc with a lifetime hint, for engines that can use one.
+  virtual void* MallocHinted(size_t size, Lifetime hint) { (void)hint; return Malloc(size); }
+
+  // Bytes of memory the engine is holding on to right now, including
+  // its own overhead and any free memory it hasn't given back.
+  virtual size_t Footprint() const = 0;
+
+  // Fills s and returns true for engines that can describe their free space.
+  virtual bool Stats(BlockStats* s) const { (void)s; return false; }
+};
+
+class MallocEngine : public Engine {
+public:
+  const char* Name() const override { return "malloc"; }
+  void* Malloc(size_t size) override { return malloc(size); }
+  void Free(void* m) override { free(m); }
+
+  size_t Footprint() const override {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+#else
+    return 0;
+#endif
+  }
+};
+
+class DlEngine : public Engine {
+public:
+  explicit DlEngine(const DlMalloc& fns) : m_Fns(fns) {}
+  const char* Name() const override { return m_Fns.Name; }
+  void* Malloc(size_t size) override { return m_Fns.Malloc(size); }
+  void Free(void* m) override { m_Fns.Free(m); }
+  size_t Footprint() const override { return 0; }
+
+private:
+  DlMalloc m_Fns;
+};
+
+template<uint32_t SIZE>
+class BlockEngine : public Engine {
+public:
+  BlockEngine(const char* name) : m_Name(name), m_HighWater(0), m_LowWater(SIZE) {
+    m_Alloc = new BlockAllocator<SIZE>;
+  }
+  ~BlockEngine() { delete m_Alloc; }
+
+  const char* Name() const override { return m_Name; }
+
+  void* Malloc(size_t size) override {
+    return MallocHinted(size, LifetimeShort);
+  }
+
+  void* MallocHinted(size_t size, Lifetime hint) override {
+    void* m = m_Alloc->Malloc(size, hint);
+    if(m) {
+      size_t offset = static_cast<char*>(m) - reinterpret_cast<char*>(m_Alloc);
+      if(hint != LifetimeShort) {
+        if(offset - sizeof(uint32_t) < m_LowWater) {
+          m_LowWater = offset - sizeof(uint32_t);
+        }
+      } else if(offset + size > m_HighWater) {
+        m_HighWater = offset + size;
+      }
+    }
+    return m;
+  }
+
+  void Free(void* m) override { m_Alloc->Free(m); }
+
+  // The arena is one fixed buffer, so report how far into it we've
+  // ever written. That's the part of SIZE the workload actually needs.
+  // Hinted blocks grow down from the end, so count those from the end.
+  size_t Footprint() const override { return m_HighWater + (SIZE - m_LowWater); }
+
+  bool Stats(BlockStats* s) const override {
+    *s = m_Alloc->GetStats();
+    return true;
+  }
+
+  BlockAllocator<SIZE>* Allocator() { return m_Alloc; }
+
+private:
+  const char* m_Name;
+  size_t m_HighWater;
+  size_t m_LowWater;
+  BlockAllocator<SIZE>* m_Alloc;
+};
+
+#define XO_BENCH_BLOCK_SIZES(X) \
+  X("block-64k", 64u << 10)     \
+  X("block-1m",  1u << 20)      \
+  X("block-16m", 16u << 20)     \
+  X("block-256m", 256u << 20)   \
+  X("block-1g",  1u << 30)
+
+// Returns nullptr for names we don't know. Caller deletes.
+inline Engine* CreateEngine(const char* name) {
+  if(strcmp(name, "malloc") == 0) {
+    return new MallocEngine;
+  }
+  DlMalloc dl;
+  if(LoadDlMalloc(name, &dl)) {
+    return new DlEngine(dl);
+  }
+#define XO_BENCH_CREATE(n, s) if(strcmp(name, n) == 0) { return new BlockEngine<s>(n); }
+  XO_BENCH_BLOCK_SIZES(XO_BENCH_CREATE)
+#undef XO_BENCH_CREATE
+  return nullptr;
+}
+
+inline void PrintEngineNames(FILE* out) {
+  fprintf(out, "  malloc\n");
+  const char* dl[] = { "jemalloc", "tcmalloc", "mimalloc" };
+  for(const char* name : dl) {
+    DlMalloc fns;
+    fprintf(out, "  %s%s\n", name, LoadDlMalloc(name, &fns) ? "" : " (not found)");
+  }
+#define XO_BENCH_PRINT(n, s) fprintf(out, "  %s\n", n);
+  XO_BENCH_BLOCK_SIZES(XO_BENCH_PRINT)
+#undef XO_BENCH_PRINT
+}
+
+////////////////////////////////////////////////////////////////////// Apis
+
+// The same allocators as the engines above, but as plain classes for
+// benchmarks that call them through templates. New/Delete construct
+// in place for the engines that don't have them.
+
+struct MallocApi {
+  const char* Name() const { return "malloc"; }
+  void Reset() {}
+  void* Malloc(size_t size) { return malloc(size); }
+  void Free(void* m) { free(m); }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    void* m = malloc(sizeof(T));
+    return m ? new(m) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      free(m);
+    }
+  }
+};
+
+struct DlApi {
+  DlMalloc Fns;
+
+  const char* Name() const { return Fns.Name; }
+  void Reset() {}
+  void* Malloc(size_t size) { return Fns.Malloc(size); }
+  void Free(void* m) { Fns.Free(m); }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    void* m = Fns.Malloc(sizeof(T));
+    return m ? new(m) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Fns.Free(m);
+    }
+  }
+};
+
+// Reset() swaps in a fresh allocator so every benchmark starts empty.
+template<uint32_t SIZE, typename CLASSES = SizeClasses<> >
+struct BlockApi {
+  typedef BlockAllocator<SIZE, CLASSES> Allocator;
+  const char* Label;
+  Allocator* Alloc;
+
+  explicit BlockApi(const char* label) : Label(label), Alloc(new Allocator) {}
+  ~BlockApi() { delete Alloc; }
+
+  const char* Name() const { return Label; }
+
+  void Reset() {
+    delete Alloc;
+    Alloc = new Allocator;
+  }
+
+  void* Malloc(size_t size) { return Alloc->Malloc(size); }
+  void Free(void* m) { Alloc->Free(m); }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) { return Alloc->template New<T>(args...); }
+
+  template<typename T>
+  void Delete(T* m) { Alloc->Delete(m); }
+};
+
+// Only for FIFO benchmarks: anything else wastes the ring.
+template<uint32_t SIZE>
+struct RingApi {
+  typedef RingAllocator<SIZE> Allocator;
+  const char* Label;
+  Allocator* Alloc;
+
+  explicit RingApi(const char* label) : Label(label), Alloc(new Allocator) {}
+  ~RingApi() { delete Alloc; }
+
+  const char* Name() const { return Label; }
+
+  void Reset() {
+    delete Alloc;
+    Alloc = new Allocator;
+  }
+
+  void* Malloc(size_t size) { return Alloc->Malloc(size); }
+  void Free(void* m) { Alloc->Free(m); }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) { return Alloc->template New<T>(args...); }
+
+  template<typename T>
+  void Delete(T* m) { Alloc->Delete(m); }
+};
+
+// Free is a no-op; memory comes back N-1 BeginFrames later.
+template<uint32_t SIZE, uint32_t N>
+struct FrameApi {
+  typedef FrameAllocator<SIZE, N> Allocator;
+  const char* Label;
+  Allocator* Alloc;
+
+  explicit FrameApi(const char* label) : Label(label), Alloc(new Allocator) {}
+  ~FrameApi() { delete Alloc; }
+
+  const char* Name() const { return Label; }
+
+  void Reset() {
+    delete Alloc;
+    Alloc = new Allocator;
+  }
+
+  void BeginFrame() { Alloc->BeginFrame(); }
+
+  void* Malloc(size_t size) { return Alloc->Malloc(size); }
+  void Free(void* m) { Alloc->Free(m); }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) { return Alloc->template New<T>(args...); }
+
+  template<typename T>
+  void Delete(T* m) { Alloc->Delete(m); }
+};
+
+////////////////////////////////////////////////////////////////////// PerfCounters
+
+class PerfCounters {
+public:
+  enum Counter {
+    Cycles,
+    Instructions,
+    L1dMisses,
+    LlcMisses,
+    DtlbMisses,
+    BranchMisses,
+    CounterCount
+  };
+
+  static const char* Name(int c) {
+    static const char* names[CounterCount] = {
+      "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+    };
+    return names[c];
+  }
+
+  PerfCounters() {
+    for(int c = 0; c < CounterCount; ++c) {
+      m_Fd[c] = -1;
+      m_Value[c] = 0;
+    }
+#if defined(XO_BENCH_PERF)
+    struct Config { uint32_t Type; uint64_t Id; };
+    const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const Config configs[CounterCount] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | readMiss },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | readMiss },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+    for(int c = 0; c < CounterCount; ++c) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = configs[c].Type;
+      attr.config = configs[c].Id;
+      attr.disabled = 1;
+      attr.inherit = 1; // count threads the benchmark starts, too
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      m_Fd[c] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#if defined(XO_BENCH_PERF)
+    for(int c = 0; c < CounterCount; ++c) {
+      if(m_Fd[c] >= 0) {
+        close(m_Fd[c]);
+      }
+    }
+#endif
+  }
+
+  bool Available(int c) const { return m_Fd[c] >= 0; }
+
+  bool AnyAvailable() const {
+    for(int c = 0; c < CounterCount; ++c) {
+      if(Available(c)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Start() {
+#if defined(XO_BENCH_PERF)
+    for(int c = 0; c < CounterCount; ++c) {
+      if(m_Fd[c] >= 0) {
+        ioctl(m_Fd[c], PERF_EVENT_IOC_RESET, 0);
+        ioctl(m_Fd[c], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void Stop() {
+#if defined(XO_BENCH_PERF)
+    for(int c = 0; c < CounterCount; ++c) {
+      if(m_Fd[c] >= 0) {
+        ioctl(m_Fd[c], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for(int c = 0; c < CounterCount; ++c) {
+      uint64_t v[3]; // value, time enabled, time running
+      if(m_Fd[c] < 0 || read(m_Fd[c], v, sizeof(v)) != sizeof(v)) {
+        m_Value[c] = 0;
+        continue;
+      }
+      // scale up if the kernel had to multiplex this counter.
+      m_Value[c] = v[2] ? static_cast<uint64_t>(double(v[0]) * double(v[1]) / double(v[2])) : 0;
+    }
+#endif
+  }
+
+  // The count between the last Start and Stop.
+  uint64_t Value(int c) const { return m_Value[c]; }
+
+private:
+  int m_Fd[CounterCount];
+  uint64_t m_Value[CounterCount];
+};
+
+////////////////////////////////////////////////////////////////////// Suite
+
+struct Result {
+  std::string Benchmark;
+  std::string Engine;
+  uint64_t Ops;
+  double NsPerOp;             // median over Trials
+  std::vector<double> Trials; // ns per op of each run
+  std::vector<double> P50s;   // sampled latency of each run, where
+  std::vector<double> P99s;   // the benchmark uses OpBegin/OpEnd
+  std::vector<std::pair<std::string, double> > Metrics;
+
+  double NsMin() const { return *std::min_element(Trials.begin(), Trials.end()); }
+  double NsMax() const { return *std::max_element(Trials.begin(), Trials.end()); }
+  double P99Min() const { return *std::min_element(P99s.begin(), P99s.end()); }
+  double P99Max() const { return *std::max_element(P99s.begin(), P99s.end()); }
+};
+
+inline double Median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  size_t mid = v.size() / 2;
+  return v.empty() ? 0.0 : v.size() % 2 ? v[mid] : (v[mid-1] + v[mid]) / 2.0;
+}
+
+// The p-th percentile (0 to 1) of v, which it reorders.
+inline double Percentile(std::vector<uint64_t>& v, double p) {
+  size_t at = static_cast<size_t>(p * double(v.size() - 1) + 0.5);
+  std::nth_element(v.begin(), v.begin() + at, v.end());
+  return double(v[at]);
+}
+
+inline void JsonString(FILE* out, const std::string& s) {
+  fputc('"', out);
+  for(char c : s) {
+    if(c == '"' || c == '\\') {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if(static_cast<unsigned char>(c) < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+class Suite {
+public:
+  // Benchmarks whose name doesn't contain filter are skipped.
+  explicit Suite(const char* filter = nullptr) : m_Filter(filter ? filter : ""), m_StartNs(0) {
+    ClearCounts();
+    // reserved up front so sampling doesn't allocate mid-benchmark.
+    m_Latency.reserve(1 << 16);
+    printf("hardware counters:");
+    for(int c = 0; c < PerfCounters::CounterCount; ++c) {
+      if(m_Perf.Available(c)) {
+        printf(" %s", PerfCounters::Name(c));
+      }
+    }
+    printf("%s\n", m_Perf.AnyAvailable() ? "" : " none available, timing only");
+  }
+
+  bool Wants(const std::string& benchmark) const {
+    return m_Filter.empty() || benchmark.find(m_Filter) != std::string::npos;
+  }
+
+  // Brackets the part of a benchmark being measured. Stop returns the
+  // nanoseconds since Start. Counters add up over several Start/Stop
+  // pairs until the next Add.
+  void Start() {
+    m_Perf.Start();
+    m_StartNs = NowNs();
+  }
+
+  uint64_t Stop() {
+    uint64_t ns = NowNs() - m_StartNs;
+    m_Perf.Stop();
+    for(int c = 0; c < PerfCounters::CounterCount; ++c) {
+      m_Counts[c] += m_Perf.Value(c);
+    }
+    return ns;
+  }
+
+  static const uint64_t LatencyEvery = 16;
+
+  // Around one op of a benchmark, numbered from 0. Only every
+  // LatencyEvery-th op is timed:
+  //
+  //   uint64_t t = suite.OpBegin(i);
+  //   api.Free(slot);
+  //   slot = api.Malloc(size);
+  //   suite.OpEnd(t);
+  uint64_t OpBegin(uint64_t op) const {
+    return op % LatencyEvery ? 0 : NowNs();
+  }
+
+  void OpEnd(uint64_t begin) {
+    if(begin) {
+      m_Latency.push_back(NowNs() - begin);
+    }
+  }
+
+  // Adding a benchmark/engine pair that's already here adds a trial to
+  // the existing result. Counters are kept from the latest trial.
+  void Add(const std::string& benchmark, const std::string& engine, uint64_t ops, uint64_t ns) {
+    Result* found = Find(benchmark, engine);
+    if(!found) {
+      m_Results.push_back(Result());
+      found = &m_Results.back();
+      found->Benchmark = benchmark;
+      found->Engine = engine;
+    }
+    Result& r = *found;
+    double nsPerOp = ops ? double(ns) / double(ops) : 0.0;
+    r.Ops = ops;
+    r.Trials.push_back(nsPerOp);
+    r.NsPerOp = Median(r.Trials);
+    r.Metrics.clear();
+
+    printf("%-36s %-16s %12llu %10.2f ns/op %10.2f Mops/s",
+      r.Benchmark.c_str(), r.Engine.c_str(), static_cast<unsigned long long>(r.Ops),
+      nsPerOp, nsPerOp > 0 ? 1e3 / nsPerOp : 0.0);
+    if(!m_Latency.empty()) {
+      r.P50s.push_back(Percentile(m_Latency, 0.50));
+      r.P99s.push_back(Percentile(m_Latency, 0.99));
+      m_Latency.clear();
+      printf("  p50 %.0f p99 %.0f ns", r.P50s.back(), r.P99s.back());
+    }
+    if(r.Trials.size() > 1) {
+      printf("  trial %zu, median %.2f", r.Trials.size(), r.NsPerOp);
+    }
+    printf("\n");
+
+    if(m_Perf.AnyAvailable() && ops) {
+      printf("%-36s", "");
+      for(int c = 0; c < PerfCounters::CounterCount; ++c) {
+        if(m_Perf.Available(c)) {
+          double perOp = double(m_Counts[c]) / double(ops);
+          r.Metrics.push_back(std::make_pair(std::string(PerfCounters::Name(c)) + "_per_op", perOp));
+          printf(" %s %.2f", PerfCounters::Name(c), perOp);
+        }
+      }
+      printf(" /op\n");
+    }
+    ClearCounts();
+    fflush(stdout);
+  }
+
+  Result* Find(const std::string& benchmark, const std::string& engine) {
+    for(Result& r : m_Results) {
+      if(r.Benchmark == benchmark && r.Engine == engine) {
+        return &r;
+      }
+    }
+    return nullptr;
+  }
+
+  // Attaches an extra named number to the result added last.
+  void Metric(const char* key, double value) {
+    if(m_Results.empty()) {
+      return;
+    }
+    m_Results.back().Metrics.push_back(std::make_pair(std::string(key), value));
+    printf("%-36s %-16s %12s %10.3f %s\n", "", "", "", value, key);
+  }
+
+  // A top level key in the JSON recording how the run was made.
+  void Setting(const char* key, double value) {
+    m_Settings.push_back(std::make_pair(std::string(key), value));
+  }
+
+  const std::vector<Result>& Results() const { return m_Results; }
+  const std::vector<std::pair<std::string, double> >& Settings() const { return m_Settings; }
+
+  bool WriteJson(const char* path) const {
+    FILE* out = fopen(path, "w");
+    if(!out) {
+      return false;
+    }
+    char when[64];
+    time_t now = time(nullptr);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(out, "{\n  \"version\": 1,\n  \"host\": ");
+    JsonString(out, Host());
+    fprintf(out, ",\n  \"compiler\": ");
+    JsonString(out, Compiler());
+    fprintf(out, ",\n  \"time\": \"%s\",\n", when);
+    for(const std::pair<std::string, double>& setting : m_Settings) {
+      fprintf(out, "  ");
+      JsonString(out, setting.first);
+      fprintf(out, ": %.6g,\n", setting.second);
+    }
+    fprintf(out, "  \"results\": [\n");
+    for(size_t i = 0; i < m_Results.size(); ++i) {
+      const Result& r = m_Results[i];
+      fprintf(out, "    { \"benchmark\": ");
+      JsonString(out, r.Benchmark);
+      fprintf(out, ", \"engine\": ");
+      JsonString(out, r.Engine);
+      fprintf(out, ", \"ops\": %llu, \"ns_per_op\": %.3f, \"trials\": %zu",
+        static_cast<unsigned long long>(r.Ops), r.NsPerOp, r.Trials.size());
+      if(r.Trials.size() > 1) {
+        fprintf(out, ", \"ns_min\": %.3f, \"ns_max\": %.3f", r.NsMin(), r.NsMax());
+      }
+      if(!r.P99s.empty()) {
+        fprintf(out, ", \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p99_min\": %.0f, \"p99_max\": %.0f",
+          Median(r.P50s), Median(r.P99s), r.P99Min(), r.P99Max());
+      }
+      for(const std::pair<std::string, double>& m : r.Metrics) {
+        fprintf(out, ", ");
+        JsonString(out, m.first);
+        fprintf(out, ": %.6g", m.second);
+      }
+      fprintf(out, " }%s\n", i+1 < m_Results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+  }
+
+  static std::string Host() {
+    char host[256] = "unknown";
+#if defined(XO_BENCH_DLOPEN)
+    gethostname(host, sizeof(host)-1);
+#endif
+    return host;
+  }
+
+  static std::string Compiler() {
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+  }
+
+private:
+  void ClearCounts() {
+    for(int c = 0; c < PerfCounters::CounterCount; ++c) {
+      m_Counts[c] = 0;
+    }
+  }
+
+  std::string m_Filter;
+  std::vector<Result> m_Results;
+  std::vector<std::pair<std::string, double> > m_Settings;
+  std::vector<uint64_t> m_Latency; // this trial's samples
+  PerfCounters m_Perf;
+  uint64_t m_StartNs;
+  uint64_t m_Counts[PerfCounters::CounterCount];
+};
+
+////////////////////////////////////////////////////////////////////// Baseline
+
+struct BaselineEntry {
+  std::string Benchmark;
+  std::string Engine;
+  double NsPerOp;
+  double NsMin;     // negative when the file doesn't have them
+  double P99;       // median over trials
+  double P99Min;
+  double Threshold; // negative when the entry doesn't set one
+};
+
+struct Baseline {
+  std::string Host;
+  std::string Compiler;
+  std::vector<std::pair<std::string, double> > Settings;
+  std::vector<BaselineEntry> Entries;
+};
+
+// Just enough JSON to read back the files Suite writes (and hand edits
+// of them). Unknown keys and values of any type are skipped.
+class JsonReader {
+public:
+  explicit JsonReader(const std::string& text) : m_Text(text), m_Pos(0) {}
+
+  bool ReadBaseline(Baseline* out) {
+    return Object([&](const std::string& key) {
+      if(key == "host") {
+        return String(&out->Host);
+      } else if(key == "compiler") {
+        return String(&out->Compiler);
+      } else if(key == "scale" || key == "trials") {
+        double value;
+        if(!Number(&value)) {
+          return false;
+        }
+        out->Settings.push_back(std::make_pair(key, value));
+        return true;
+      } else if(key != "results") {
+        return SkipValue();
+      }
+      return Array([&]() {
+        BaselineEntry e;
+        e.NsPerOp = e.NsMin = e.P99 = e.P99Min = -1.0;
+        e.Threshold = -1.0;
+        bool ok = Object([&](const std::string& field) {
+          if(field == "benchmark") {
+            return String(&e.Benchmark);
+          } else if(field == "engine") {
+            return String(&e.Engine);
+          } else if(field == "ns_per_op") {
+            return Number(&e.NsPerOp);
+          } else if(field == "ns_min") {
+            return Number(&e.NsMin);
+          } else if(field == "p99_ns") {
+            return Number(&e.P99);
+          } else if(field == "p99_min") {
+            return Number(&e.P99Min);
+          } else if(field == "threshold") {
+            return Number(&e.Threshold);
+          }
+          return SkipValue();
+        });
+        if(ok && !e.Benchmark.empty() && e.NsPerOp >= 0.0) {
+          out->Entries.push_back(e);
+        }
+        return ok;
+      });
+    });
+  }
+
+private:
+  void Space() {
+    while(m_Pos < m_Text.size() && strchr(" \t\r\n", m_Text[m_Pos])) {
+      ++m_Pos;
+    }
+  }
+
+  bool Eat(char c) {
+    Space();
+    if(m_Pos < m_Text.size() && m_Text[m_Pos] == c) {
+      ++m_Pos;
+      return true;
+    }
+    return false;
+  }
+
+  template<typename FN>
+  bool Object(FN field) {
+    if(!Eat('{')) {
+      return false;
+    }
+    if(Eat('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      if(!String(&key) || !Eat(':') || !field(key)) {
+        return false;
+      }
+    } while(Eat(','));
+    return Eat('}');
+  }
+
+  template<typename FN>
+  bool Array(FN element) {
+    if(!Eat('[')) {
+      return false;
+    }
+    if(Eat(']')) {
+      return true;
+    }
+    do {
+      if(!element()) {
+        return false;
+      }
+    } while(Eat(','));
+    return Eat(']');
+  }
+
+  bool String(std::string* out) {
+    if(!Eat('"')) {
+      return false;
+    }
+    out->clear();
+    while(m_Pos < m_Text.size() && m_Text[m_Pos] != '"') {
+      char c = m_Text[m_Pos++];
+      if(c == '\\' && m_Pos < m_Text.size()) {
+        c = m_Text[m_Pos++];
+        if(c == 'u') {
+          // only ever written for control characters. keep it simple.
+          c = static_cast<char>(strtol(m_Text.substr(m_Pos, 4).c_str(), nullptr, 16));
+          m_Pos += 4;
+        } else if(c == 'n') {
+          c = '\n';
+        } else if(c == 't') {
+          c = '\t';
+        }
+      }
+      out->push_back(c);
+    }
+    return Eat('"');
+  }
+
+  bool Number(double* out) {
+    Space();
+    const char* begin = m_Text.c_str() + m_Pos;
+    char* end = nullptr;
+    *out = strtod(begin, &end);
+    m_Pos += end - begin;
+    return end != begin;
+  }
+
+  bool SkipValue() {
+    Space();
+    if(m_Pos >= m_Text.size()) {
+      return false;
+    }
+    char c = m_Text[m_Pos];
+    std::string s;
+    double d;
+    if(c == '{') {
+      return Object([&](const std::string&) { return SkipValue(); });
+    } else if(c == '[') {
+      return Array([&]() { return SkipValue(); });
+    } else if(c == '"') {
+      return String(&s);
+    } else if(m_Text.compare(m_Pos, 4, "true") == 0 || m_Text.compare(m_Pos, 4, "null") == 0) {
+      m_Pos += 4;
+      return true;
+    } else if(m_Text.compare(m_Pos, 5, "false") == 0) {
+      m_Pos += 5;
+      return true;
+    }
+    return Number(&d);
+  }
+
+  const std::string& m_Text;
+  size_t m_Pos;
+};
+
+inline bool ReadBaseline(const char* path, Baseline* out) {
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    return false;
+  }
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    text.append(buf, n);
+  }
+  fclose(f);
+  return JsonReader(text).ReadBaseline(out);
+}
+
+// The slowdown allowed for one statistic: the base threshold plus
+// three times the baseline's spread for it, or just the base without
+// one.
+inline double Allowed(double base, double fastest, double median) {
+  return fastest > 0.0 && median >= fastest ? base + 3.0 * (median / fastest - 1.0) : base;
+}
+
+// Prints a diff of every result against the baseline and returns how
+// many regressed by more than they're allowed (see BASELINES). Each
+// entry is a row for its fastest trial and, with latency samples on
+// both sides, one for p99. Results the baseline doesn't have are
+// listed as new; baseline entries this run didn't produce (other than
+// ones the suite's filter skips) are listed as missing. Neither counts
+// as a regression.
+inline int CompareToBaseline(const Suite& suite, const Baseline& baseline,
+  double defaultThreshold, FILE* out) {
+  if(baseline.Host != Suite::Host()) {
+    fprintf(out, "\nwarning: baseline is from host \"%s\", this is \"%s\". Timings may not compare.\n",
+      baseline.Host.c_str(), Suite::Host().c_str());
+  }
+  for(const std::pair<std::string, double>& b : baseline.Settings) {
+    for(const std::pair<std::string, double>& s : suite.Settings()) {
+      if(b.first == s.first && b.second != s.second) {
+        fprintf(out, "warning: baseline has %s %g, this run %g.\n", b.first.c_str(), b.second, s.second);
+      }
+    }
+  }
+
+  int regressions = 0;
+  fprintf(out, "\n%-32s %-16s %-6s %12s %12s %9s %9s  %s\n",
+    "benchmark", "engine", "stat", "base ns", "now ns", "change", "allowed", "status");
+  auto row = [&](const BaselineEntry& b, const char* stat, double base, double now, double allowed) {
+    double change = base > 0.0 ? now / base - 1.0 : 0.0;
+    const char* status = "ok";
+    if(change > allowed) {
+      status = "REGRESSED";
+      ++regressions;
+    } else if(change < -allowed) {
+      status = "improved";
+    }
+    fprintf(out, "%-32s %-16s %-6s %12.2f %12.2f %+8.1f%% %8.1f%%  %s\n",
+      b.Benchmark.c_str(), b.Engine.c_str(), stat, base, now, change * 100.0, allowed * 100.0, status);
+  };
+  for(const BaselineEntry& b : baseline.Entries) {
+    if(!suite.Wants(b.Benchmark)) {
+      continue;
+    }
+    const Result* found = nullptr;
+    for(const Result& r : suite.Results()) {
+      if(r.Benchmark == b.Benchmark && r.Engine == b.Engine) {
+        found = &r;
+      }
+    }
+    double threshold = b.Threshold >= 0.0 ? b.Threshold : defaultThreshold;
+    if(!found) {
+      fprintf(out, "%-32s %-16s %-6s %12.2f %12s %9s %8.1f%%  missing\n",
+        b.Benchmark.c_str(), b.Engine.c_str(), "min", b.NsMin > 0.0 ? b.NsMin : b.NsPerOp, "-", "-",
+        threshold * 100.0);
+      continue;
+    }
+    // files without ns_min come from single trials.
+    double base = b.NsMin > 0.0 ? b.NsMin : b.NsPerOp;
+    row(b, "min", base, found->NsMin(), Allowed(threshold, b.NsMin, b.NsPerOp));
+    if(b.P99Min > 0.0 && !found->P99s.empty()) {
+      row(b, "p99", b.P99Min, found->P99Min(), Allowed(threshold, b.P99Min, b.P99));
+    }
+  }
+  for(const Result& r : suite.Results()) {
+    bool known = false;
+    for(const BaselineEntry& b : baseline.Entries) {
+      known = known || (r.Benchmark == b.Benchmark && r.Engine == b.Engine);
+    }
+    if(!known) {
+      fprintf(out, "%-32s %-16s %-6s %12s %12.2f %9s %9s  new\n",
+        r.Benchmark.c_str(), r.Engine.c_str(), "min", "-", r.NsMin(), "-", "-");
+    }
+  }
+  fprintf(out, "\n%d regression%s.\n", regressions, regressions == 1 ? "" : "s");
+  return regressions;
+}
+
+} // namespace bench
+} // namespace xo
@@ -1,7 +1,6 @@
 #include "xo-alloc.h"
 
 #include <iostream>
-#include <stdio.h>
 #include <string>
 
 using std::string;
@@ -27,7 +26,7 @@ struct LevelData {
 };
 
 int main() {
-  xo::BlockAllocator<2048> Alloc;
+  xo::BlockAllocator<4096> Alloc;
 
   cout << "demo for xo-alloc version: " << XO_ALLOC_VER << endl;
 
@@ -36,19 +35,14 @@ int main() {
   // If New returns null, the allocation failed.
   LevelData* level = Alloc.New<LevelData>("My Level");
 
-  if(FILE* f = fopen("demo.cpp", "r")) {
-    fseek(f, 0, SEEK_END);
-    level->Size = ftell(f);
-    rewind(f);
-
-    // Data can be allocated with the Malloc function as well,
-    // which calls no constructor, and returns a void*
-    // If Malloc returns null, the allocation failed.
-    level->FileContents = static_cast<char*>(Alloc.Malloc(level->Size+1));
-
-    fread(level->FileContents, 1, level->Size, f);
-    level->FileContents[level->Size] = '\0';
-    fclose(f);
+  // LoadFile reads a whole file into a single block from the allocator,
+  // sized from the file itself. Passing true adds a NUL terminator.
+  // If Data is null, the file couldn't be opened or didn't fit.
+  // It allocates with Malloc, so the block is returned with Free.
+  xo::Span file = Alloc.LoadFile("demo.cpp", true);
+  if(file.Data) {
+    level->FileContents = file.Data;
+    level->Size = file.Size;
     cout << "Level file \"" << level->LevelName << 
       "\" opened and read. Length: " << level->Size << endl;
   } else {
@@ -0,0 +1,286 @@
+//////////////////////////////////////////////////////////////////////
+//
+// tests.cpp
+//
+// Checks the cases the allocators are easiest to get wrong: ring
+// wraparound and out of order frees, pool double frees, ChainBuffer
+// rolling back a failed Append, ArenaPool shared between threads, and
+// generational handles through Collect, Delete and slot reuse.
+//
+// BUILD:
+//   g++ -std=c++11 -O2 -pthread tests.cpp -o tests
+//
+// USAGE:
+//   tests
+//
+//   Prints each group as it passes. A failure is an assert, so this
+//   is never built with NDEBUG.
+//
+//////////////////////////////////////////////////////////////////////
+#undef NDEBUG
+#include "xo-alloc.h"
+#include "xo-alloc-io.h"
+
+#include <assert.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+////////////////////////////////////////////////////////////////////// RingAllocator
+
+struct Record {
+  unsigned char* Data;
+  uint32_t Size;
+  unsigned char Fill;
+};
+
+void Check(const Record& r) {
+  for(uint32_t i = 0; i < r.Size; ++i) {
+    assert(r.Data[i] == r.Fill);
+  }
+}
+
+void TestRing() {
+  xo::RingAllocator<256> ring;
+  std::vector<Record> live;
+  unsigned char fill = 1;
+
+  // enough rounds of allocate, free oldest, to wrap many times, with
+  // sizes that don't divide the buffer so some records skip the end.
+  for(int round = 0; round < 1000; ++round) {
+    uint32_t size = 8 + uint32_t(round * 7) % 41;
+    void* m = ring.Malloc(size);
+    while(!m) {
+      assert(!live.empty());
+      Check(live.front());
+      ring.Free(live.front().Data);
+      live.erase(live.begin());
+      m = ring.Malloc(size);
+    }
+    assert(ring.Owns(m));
+    Record r = { static_cast<unsigned char*>(m), size, fill++ };
+    memset(r.Data, r.Fill, size);
+    live.push_back(r);
+  }
+  for(const Record& r : live) {
+    Check(r);
+  }
+
+  // out of order: the newest first. Nothing comes back until the
+  // oldest goes, then everything does.
+  uint32_t used = ring.Used();
+  for(size_t i = live.size() - 1; i > 0; --i) {
+    ring.Free(live[i].Data);
+    assert(ring.Used() == used);
+    Check(live[0]);
+  }
+  ring.Free(live[0].Data);
+  assert(ring.Used() == 0);
+
+  // a pointer that isn't a record is ignored.
+  void* a = ring.Malloc(16);
+  ring.Free(static_cast<char*>(a) + 1);
+  assert(ring.Used() != 0);
+  ring.Free(a);
+  assert(ring.Used() == 0);
+  printf("ring ok\n");
+}
+
+////////////////////////////////////////////////////////////////////// PoolAllocator
+
+void TestPool() {
+  xo::PoolAllocator<32, 4> pool;
+  void* a = pool.Malloc(32);
+  void* b = pool.Malloc(32);
+  assert(a && b && a != b && pool.Used() == 2);
+
+  // a double free, and a pointer into the middle of a block, change
+  // nothing.
+  pool.Free(a);
+  pool.Free(a);
+  pool.Free(static_cast<char*>(b) + 4);
+  assert(pool.Used() == 1);
+
+  // so every block still comes out once.
+  void* c[4];
+  for(int i = 0; i < 3; ++i) {
+    c[i] = pool.Malloc(32);
+    assert(c[i] && c[i] != b);
+    for(int j = 0; j < i; ++j) {
+      assert(c[j] != c[i]);
+    }
+  }
+  assert(pool.Malloc(32) == nullptr && pool.Used() == 4);
+  for(int i = 0; i < 3; ++i) {
+    pool.Free(c[i]);
+  }
+  pool.Free(b);
+  assert(pool.Used() == 0);
+  printf("pool ok\n");
+}
+
+////////////////////////////////////////////////////////////////////// ChainBuffer
+
+std::string Contents(const xo::ChainBuffer<xo::PoolAllocator<64, 3> >& chain) {
+  std::string s;
+  for(size_t i = 0; i < chain.IovCount(); ++i) {
+    s.append(static_cast<const char*>(chain.Iov()[i].iov_base), chain.Iov()[i].iov_len);
+  }
+  return s;
+}
+
+void TestChainBuffer() {
+  xo::PoolAllocator<64, 3> segments;
+  xo::ChainBuffer<xo::PoolAllocator<64, 3> > chain(segments, 64);
+  std::string big(200, 'x');
+
+  assert(chain.Append("hello", 5));
+  assert(segments.Used() == 1);
+
+  // needs four segments and there are two left: nothing changes.
+  assert(!chain.Append(big.data(), big.size()));
+  assert(chain.Size() == 5 && Contents(chain) == "hello");
+  assert(segments.Used() == 1);
+
+  // the tail segment's room is still there to use.
+  std::string more(100, 'y');
+  assert(chain.Append(more.data(), more.size()));
+  assert(chain.Size() == 105 && Contents(chain) == "hello" + more);
+  assert(segments.Used() == 2);
+
+  chain.Consume(105);
+  chain.Clear();
+  assert(segments.Used() == 0);
+  printf("chain buffer ok\n");
+}
+
+////////////////////////////////////////////////////////////////////// ArenaPool
+
+void TestArenaPool() {
+  typedef xo::LinearAllocator<4096> Arena;
+  xo::ArenaPool<Arena, 8, std::mutex> pool;
+  const int threads = 6;
+  const int rounds = 20000;
+
+  std::vector<std::thread> workers;
+  for(int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&pool, t] {
+      for(int i = 0; i < rounds; ++i) {
+        Arena* arena = pool.Checkout();
+        if(!arena) {
+          continue;
+        }
+        // a checked out arena is reset, and ours alone until returned.
+        assert(arena->Used() == 0);
+        int* mine = arena->New<int>(t);
+        for(int k = 0; k < 16; ++k) {
+          arena->Malloc(64);
+        }
+        assert(*mine == t);
+        pool.Return(arena);
+      }
+    }));
+  }
+  for(std::thread& w : workers) {
+    w.join();
+  }
+
+  xo::ArenaPoolStats stats = pool.GetStats();
+  assert(stats.Live <= 8 && stats.Idle == stats.Live);
+  assert(stats.Checkouts == uint64_t(threads) * rounds);
+
+  // a second Return, or one of an arena from elsewhere, is ignored.
+  Arena* arena = pool.Checkout();
+  pool.Return(arena);
+  pool.Return(arena);
+  Arena stray;
+  pool.Return(&stray);
+  assert(pool.GetStats().Idle == stats.Idle);
+  printf("arena pool ok\n");
+}
+
+////////////////////////////////////////////////////////////////////// GenerationalAllocator
+
+struct Tracked {
+  int Value;
+
+  explicit Tracked(int v) : Value(v) {}
+  Tracked(Tracked&& o) : Value(o.Value) { o.Value = -1; }
+};
+
+void TestGenerational() {
+  typedef xo::GenerationalAllocator<4096, 1 << 16, 4> Heap;
+  Heap* heap = new Heap;
+
+  // a handle survives Collect, moved into the tenured space.
+  xo::Handle<Tracked> kept = heap->NewHandle<Tracked>(1);
+  heap->New<Tracked>(2); // garbage
+  assert(heap->GetNursery().Owns(heap->Get(kept)));
+  assert(heap->Collect());
+  Tracked* t = heap->Get(kept);
+  assert(t && !heap->GetNursery().Owns(t) && t->Value == 1);
+
+  // deleting a handled object by pointer frees the handle: Collect
+  // doesn't try to move it, and the handle resolves to nothing.
+  xo::Handle<Tracked> gone = heap->NewHandle<Tracked>(3);
+  heap->Delete(heap->Get(gone));
+  assert(!heap->Get(gone));
+  assert(heap->Collect());
+  assert(!heap->Get(gone));
+
+  // a stale handle doesn't reach the object that reused its slot.
+  xo::Handle<Tracked> reused = heap->NewHandle<Tracked>(4);
+  assert(reused.Index() == gone.Index() && reused != gone);
+  assert(!heap->Get(gone) && heap->Get(reused)->Value == 4);
+  heap->Delete(gone); // ignored
+  assert(heap->Get(reused) && heap->Get(reused)->Value == 4);
+
+  // Promote moves the handle with the object.
+  Tracked* promoted = heap->Promote(heap->Get(reused));
+  assert(promoted && heap->Get(reused) == promoted && promoted->Value == 4);
+
+  // Free of a tenured object by pointer frees its handle too.
+  heap->Free(promoted);
+  assert(!heap->Get(reused));
+
+  // the table is full at four handles; freeing one makes room.
+  xo::Handle<Tracked> h[4];
+  h[0] = kept;
+  for(int i = 1; i < 4; ++i) {
+    h[i] = heap->NewHandle<Tracked>(10 + i);
+    assert(h[i]);
+  }
+  assert(!heap->NewHandle<Tracked>(99));
+  heap->Delete(h[2]);
+  xo::Handle<Tracked> last = heap->NewHandle<Tracked>(20);
+  assert(last);
+  assert(heap->Collect());
+  assert(heap->Get(h[0])->Value == 1 && heap->Get(h[1])->Value == 11);
+  assert(heap->Get(h[3])->Value == 13 && heap->Get(last)->Value == 20);
+  assert(!heap->Get(h[2]));
+
+  heap->Delete(h[0]);
+  heap->Delete(h[1]);
+  heap->Delete(h[3]);
+  heap->Delete(last);
+  assert(heap->GetTenured().GetStats().UsedBlocks == 0);
+  delete heap;
+  printf("generational ok\n");
+}
+
+} // namespace
+
+int main() {
+  TestRing();
+  TestPool();
+  TestChainBuffer();
+  TestArenaPool();
+  TestGenerational();
+  printf("all ok\n");
+  return 0;
+}
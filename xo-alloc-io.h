@@ -0,0 +1,856 @@
+//////////////////////////////////////////////////////////////////////
+//
+// xo-alloc-io.h (version 0.2) public domain
+//
+// Asynchronous file loading into xo allocators, and aligned I/O
+// buffers. A companion to xo-alloc.h. C++11 or newer required, POSIX only.
+//
+// USAGE:
+//   xo::BlockAllocator<64 << 20> Arena;
+//   xo::AsyncLoader<xo::BlockAllocator<64 << 20> > Loader(Arena);
+//
+//   Loader.Load("level.bin", [](const xo::LoadResult& r) {
+//     if(r.File.Data) { /* r.File.Size bytes */ }
+//   });
+//   std::future<xo::Span> tex = Loader.LoadFuture("level.tex");
+//
+//   Loader.Wait(); // runs callbacks, readies futures
+//
+// IMPLEMENTATION NOTES:
+//
+//   Load opens the file, sizes it with fstat and Mallocs the
+//   destination block on the calling thread, so the allocator is only
+//   ever touched from that thread. The reads themselves are queued and
+//   submitted in batches of up to the queue depth.
+//
+//   On Linux the reads go through io_uring, driven with raw syscalls
+//   (no liburing). When io_uring can't be set up (old kernels,
+//   seccomp, containers) or XO_ALLOC_IO_NO_URING is defined, a small
+//   pool of threads does pread loops instead.
+//
+//   Either way, completions are only delivered from Poll or Wait, on
+//   the thread that calls them. Callbacks run there, futures become
+//   ready there, and failed loads are Freed there. A future returned
+//   by LoadFuture won't become ready unless someone calls Poll or Wait.
+//
+//   IoBufferPool hands out page aligned fixed size buffers for O_DIRECT
+//   from one PoolAllocator region, and can register that region with an
+//   IoUring so fixed reads and writes skip per operation pinning.
+//
+//   ChainBuffer strings pool segments and borrowed buffers into one
+//   stream for writev, so responses are assembled without copying
+//   what's already been assembled.
+//
+// LICENSE
+//   See end of xo-alloc.h for license information.
+//
+//////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "xo-alloc.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(XO_ALLOC_IO_NO_URING)
+#define XO_ALLOC_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+XO_NAMESPACE_BEGIN
+
+////////////////////////////////////////////////////////////////////// IoUring
+
+#if defined(XO_ALLOC_IO_URING)
+
+// Just enough of io_uring for batched reads: one submission ring, one
+// completion ring, no SQPOLL. Not thread safe.
+class IoUring {
+public:
+  IoUring() : m_Fd(-1), m_SqMap(nullptr), m_CqMap(nullptr), m_Sqes(nullptr) {}
+  ~IoUring() { Close(); }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // Returns false (and leaves the ring unusable) if the kernel says no.
+  bool Init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_Fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if(m_Fd < 0) {
+      return false;
+    }
+    m_SqSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_CqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single) {
+      m_SqSize = m_CqSize = m_SqSize > m_CqSize ? m_SqSize : m_CqSize;
+    }
+    m_SqMap = Map(m_SqSize, IORING_OFF_SQ_RING);
+    m_CqMap = single ? m_SqMap : Map(m_CqSize, IORING_OFF_CQ_RING);
+    m_Sqes = static_cast<io_uring_sqe*>(Map(p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+    m_SqeCount = p.sq_entries;
+    if(!m_SqMap || !m_CqMap || !m_Sqes) {
+      Close();
+      return false;
+    }
+    char* sq = static_cast<char*>(m_SqMap);
+    char* cq = static_cast<char*>(m_CqMap);
+    m_SqHead = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+    m_SqTail = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+    m_SqMask = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+    m_SqArray = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+    m_CqHead = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+    m_CqTail = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+    m_CqMask = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+    m_Cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    m_SqLocalTail = *m_SqTail;
+    m_Unsubmitted = 0;
+    return true;
+  }
+
+  bool Valid() const { return m_Fd >= 0; }
+  int Fd() const { return m_Fd; }
+  uint32_t Entries() const { return m_SqeCount; }
+
+  // Returns nullptr when the submission ring is full; Submit first.
+  // The kernel doesn't see the sqe until Submit publishes the tail, so
+  // the caller can fill it in first.
+  io_uring_sqe* Next() {
+    uint32_t head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+    uint32_t tail = m_SqLocalTail;
+    if(tail - head >= m_SqeCount) {
+      return nullptr;
+    }
+    io_uring_sqe* sqe = &m_Sqes[tail & m_SqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_SqArray[tail & m_SqMask] = tail & m_SqMask;
+    m_SqLocalTail = tail + 1;
+    m_Unsubmitted++;
+    return sqe;
+  }
+
+  // Publishes every sqe from Next and hands them to the kernel in one
+  // syscall, and optionally blocks until at least waitFor completions
+  // are posted. Returns false on errors other than EINTR.
+  bool Submit(uint32_t waitFor = 0) {
+    __atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+    for(;;) {
+      long r = syscall(__NR_io_uring_enter, m_Fd, m_Unsubmitted, waitFor,
+        waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if(r >= 0) {
+        m_Unsubmitted -= static_cast<uint32_t>(r);
+        return true;
+      }
+      if(errno != EINTR) {
+        return false;
+      }
+    }
+  }
+
+  // Pins iovecs for IORING_OP_READ_FIXED/WRITE_FIXED, whose buf_index
+  // is a position in this array. Once per ring; the memory must stay
+  // valid until UnregisterBuffers or Close.
+  bool RegisterBuffers(const iovec* iovecs, uint32_t count) {
+    return syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+  }
+
+  bool UnregisterBuffers() {
+    return syscall(__NR_io_uring_register, m_Fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0;
+  }
+
+  // Calls fn(userData, res) for each posted completion.
+  template<typename FN>
+  uint32_t Reap(FN fn) {
+    uint32_t head = *m_CqHead;
+    uint32_t tail = __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE);
+    uint32_t count = 0;
+    for(; head != tail; ++head, ++count) {
+      const io_uring_cqe& cqe = m_Cqes[head & m_CqMask];
+      fn(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(m_CqHead, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  void Close() {
+    if(m_Sqes) {
+      munmap(m_Sqes, m_SqeCount * sizeof(io_uring_sqe));
+    }
+    if(m_CqMap && m_CqMap != m_SqMap) {
+      munmap(m_CqMap, m_CqSize);
+    }
+    if(m_SqMap) {
+      munmap(m_SqMap, m_SqSize);
+    }
+    if(m_Fd >= 0) {
+      close(m_Fd);
+    }
+    m_Fd = -1;
+    m_SqMap = m_CqMap = nullptr;
+    m_Sqes = nullptr;
+  }
+
+private:
+  int m_Fd;
+  void* m_SqMap;
+  void* m_CqMap;
+  size_t m_SqSize;
+  size_t m_CqSize;
+  io_uring_sqe* m_Sqes;
+  uint32_t m_SqeCount;
+  uint32_t* m_SqHead;
+  uint32_t* m_SqTail;
+  uint32_t m_SqLocalTail; // Next's tail; the kernel's is set by Submit
+  uint32_t m_SqMask;
+  uint32_t* m_SqArray;
+  uint32_t* m_CqHead;
+  uint32_t* m_CqTail;
+  uint32_t m_CqMask;
+  io_uring_cqe* m_Cqes;
+  uint32_t m_Unsubmitted;
+
+  void* Map(size_t size, off_t offset) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////// IoBufferPool
+
+// COUNT buffers of BUFFER_SIZE bytes, aligned to ALIGN, from one
+// PoolAllocator region. The defaults suit O_DIRECT on any device (4 KiB
+// covers both 512 byte and 4 KiB logical blocks), though O_DIRECT also
+// needs file offsets and lengths that are multiples of the block size.
+//
+// Registering the region with a ring pins it once, up front, instead of
+// on every operation. Fixed reads and writes then name the buffer by
+// Index:
+//
+//   xo::IoBufferPool<64 << 10, 256>* Pool = new xo::IoBufferPool<64 << 10, 256>;
+//   Pool->RegisterBuffers(Ring);
+//   char* buf = Pool->Acquire();
+//   io_uring_sqe* sqe = Ring.Next();
+//   sqe->opcode = IORING_OP_READ_FIXED;
+//   sqe->buf_index = Pool->Index(buf);
+//   // ...
+//   Pool->Release(buf);
+//
+// The buffers live inside the object, so large pools belong on the heap.
+template<uint32_t BUFFER_SIZE, uint32_t COUNT, uint32_t ALIGN = 4096>
+class IoBufferPool {
+  static_assert(BUFFER_SIZE % ALIGN == 0, "IoBufferPool buffer size must be a multiple of the alignment");
+public:
+  // nullptr when every buffer is out.
+  char* Acquire() {
+    return static_cast<char*>(m_Pool.Malloc(BUFFER_SIZE));
+  }
+
+  void Release(char* buffer) {
+    m_Pool.Free(buffer);
+  }
+
+  // The buf_index of a buffer for READ_FIXED/WRITE_FIXED.
+  uint32_t Index(const char* buffer) const {
+    return m_Pool.Index(buffer);
+  }
+
+  char* Buffer(uint32_t index) { return m_Pool.Block(index); }
+
+  uint32_t Available() const { return COUNT - m_Pool.Used(); }
+  static uint32_t Count() { return COUNT; }
+  static uint32_t BufferSize() { return BUFFER_SIZE; }
+
+#if defined(XO_ALLOC_IO_URING)
+  // One iovec per buffer, so buf_index and Index agree. Fails if the
+  // ring already has buffers, COUNT is over the kernel's limit (1024
+  // on older kernels) or the region is over RLIMIT_MEMLOCK.
+  bool RegisterBuffers(IoUring& ring) {
+    std::vector<iovec> iovecs(COUNT);
+    for(uint32_t i = 0; i < COUNT; ++i) {
+      iovecs[i].iov_base = m_Pool.Block(i);
+      iovecs[i].iov_len = BUFFER_SIZE;
+    }
+    return ring.RegisterBuffers(iovecs.data(), COUNT);
+  }
+#endif
+
+private:
+  PoolAllocator<BUFFER_SIZE, COUNT, ALIGN> m_Pool;
+};
+
+////////////////////////////////////////////////////////////////////// ChainBuffer
+
+// A byte stream built from fixed size segments out of any xo
+// allocator (a PoolAllocator, typically), exposed as an iovec array
+// for writev/sendmsg. Nothing already in the chain is ever moved:
+// Append copies a fragment into the free end of the last segment and
+// then into fresh ones, and AppendRef links a caller's buffer in
+// without copying at all.
+//
+//   xo::PoolAllocator<4096, 256> Segments;
+//   xo::ChainBuffer<xo::PoolAllocator<4096, 256> > Out(Segments, 4096);
+//   Out.Append(header, headerSize);
+//   Out.AppendRef(body, bodySize); // body must outlive its write
+//   while(!Out.Empty() && Out.WriteTo(fd) > 0) {}
+//
+// Consume drops bytes from the front once they've been written (or
+// acknowledged); segments wholly consumed go straight back to the
+// allocator. Not thread safe.
+template<typename ALLOC>
+class ChainBuffer {
+public:
+  ChainBuffer(ALLOC& alloc, uint32_t segmentSize)
+    : m_Alloc(&alloc)
+    , m_SegmentSize(segmentSize)
+    , m_First(0)
+    , m_Size(0)
+    , m_TailRoom(0) {
+  }
+
+  ~ChainBuffer() {
+    Clear();
+  }
+
+  ChainBuffer(const ChainBuffer&) = delete;
+  ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+  // Copies size bytes onto the end. Returns false, leaving the chain
+  // as it was, if the allocator runs out of segments.
+  bool Append(const void* data, size_t size) {
+    const char* src = static_cast<const char*>(data);
+    size_t live = IovCount();
+    size_t tailLen = live ? m_Iov.back().iov_len : 0;
+    uint32_t tailRoom = m_TailRoom;
+
+    while(size) {
+      if(m_TailRoom == 0) {
+        char* seg = static_cast<char*>(m_Alloc->Malloc(m_SegmentSize));
+        if(!seg) {
+          Rollback(live, tailLen, tailRoom);
+          return false;
+        }
+        Push(seg, 0, seg);
+        m_TailRoom = m_SegmentSize;
+      }
+      iovec& tail = m_Iov.back();
+      size_t n = size < m_TailRoom ? size : m_TailRoom;
+      memcpy(static_cast<char*>(tail.iov_base) + tail.iov_len, src, n);
+      tail.iov_len += n;
+      m_TailRoom -= static_cast<uint32_t>(n);
+      m_Size += n;
+      src += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  // Links size bytes at data onto the end without copying. data must
+  // stay valid and unchanged until Consume has passed it.
+  void AppendRef(const void* data, size_t size) {
+    if(size) {
+      Push(const_cast<void*>(data), size, nullptr);
+      m_Size += size;
+      m_TailRoom = 0; // later Appends mustn't write past a reference.
+    }
+  }
+
+  // Drops bytes from the front, returning whole segments to the
+  // allocator.
+  void Consume(size_t bytes) {
+    bytes = bytes < m_Size ? bytes : m_Size;
+    m_Size -= bytes;
+    while(bytes) {
+      iovec& front = m_Iov[m_First];
+      if(bytes < front.iov_len) {
+        front.iov_base = static_cast<char*>(front.iov_base) + bytes;
+        front.iov_len -= bytes;
+        return;
+      }
+      bytes -= front.iov_len;
+      PopFront();
+    }
+    // an empty owned tail segment stays for the next Append.
+  }
+
+  // The unconsumed bytes, in order. Pass at most IOV_MAX to writev.
+  const iovec* Iov() const { return m_Iov.data() + m_First; }
+  size_t IovCount() const { return m_Iov.size() - m_First; }
+
+  // One writev of up to IOV_MAX segments, then Consume of whatever the
+  // kernel took. Returns writev's result.
+  ssize_t WriteTo(int fd) {
+    size_t count = IovCount();
+    count = count < IOV_MAX ? count : IOV_MAX;
+    ssize_t n = writev(fd, Iov(), static_cast<int>(count));
+    if(n > 0) {
+      Consume(static_cast<size_t>(n));
+    }
+    return n;
+  }
+
+  size_t Size() const { return m_Size; }
+  bool Empty() const { return m_Size == 0; }
+
+  void Clear() {
+    for(size_t i = m_First; i < m_Owned.size(); ++i) {
+      m_Alloc->Free(m_Owned[i]);
+    }
+    m_Iov.clear();
+    m_Owned.clear();
+    m_First = 0;
+    m_Size = 0;
+    m_TailRoom = 0;
+  }
+
+private:
+  ALLOC* m_Alloc;
+  uint32_t m_SegmentSize;
+  std::vector<iovec> m_Iov;   // from m_First on is the live chain
+  std::vector<char*> m_Owned; // per iovec: its segment, or nullptr for refs
+  size_t m_First;
+  size_t m_Size;
+  uint32_t m_TailRoom;        // free bytes after the last iovec, if owned
+
+  void Push(void* base, size_t len, char* owned) {
+    // the consumed front is dead space; reclaim it before growing.
+    if(m_First && m_First * 2 >= m_Iov.size()) {
+      m_Iov.erase(m_Iov.begin(), m_Iov.begin() + m_First);
+      m_Owned.erase(m_Owned.begin(), m_Owned.begin() + m_First);
+      m_First = 0;
+    }
+    iovec v;
+    v.iov_base = base;
+    v.iov_len = len;
+    m_Iov.push_back(v);
+    m_Owned.push_back(owned);
+  }
+
+  void PopFront() {
+    // keep an owned tail segment that still has room for Appends.
+    if(m_First + 1 == m_Iov.size() && m_Owned[m_First] && m_TailRoom) {
+      m_Iov[m_First].iov_base = m_Owned[m_First] + (m_SegmentSize - m_TailRoom);
+      m_Iov[m_First].iov_len = 0;
+      return;
+    }
+    m_Alloc->Free(m_Owned[m_First]);
+    m_First++;
+    if(m_First == m_Iov.size()) {
+      m_Iov.clear();
+      m_Owned.clear();
+      m_First = 0;
+      m_TailRoom = 0;
+    }
+  }
+
+  // Undoes a failed Append: back to live iovecs, the last tailLen long.
+  void Rollback(size_t live, size_t tailLen, uint32_t tailRoom) {
+    while(IovCount() > live) {
+      m_Size -= m_Iov.back().iov_len;
+      m_Alloc->Free(m_Owned.back());
+      m_Iov.pop_back();
+      m_Owned.pop_back();
+    }
+    if(live) {
+      m_Size -= m_Iov.back().iov_len - tailLen;
+      m_Iov.back().iov_len = tailLen;
+    }
+    m_TailRoom = tailRoom;
+  }
+};
+
+////////////////////////////////////////////////////////////////////// AsyncLoader
+
+struct LoadResult {
+  const char* Path;
+  Span File;  // Data is nullptr if the load failed
+  int Error;  // errno of the failure, 0 on success
+};
+
+typedef std::function<void(const LoadResult&)> LoadCallback;
+
+template<typename ALLOC>
+class AsyncLoader {
+public:
+  // depth is the most reads in flight at once, and the batch size.
+  // threads is the fallback pool's size (0: one per core).
+  explicit AsyncLoader(ALLOC& alloc, uint32_t depth = 64, uint32_t threads = 4, bool useUring = true)
+    : m_Alloc(&alloc)
+    , m_Depth(depth ? depth : 1)
+    , m_InFlight(0)
+    , m_Threads(threads)
+    , m_Stop(false) {
+#if defined(XO_ALLOC_IO_URING)
+    if(useUring) {
+      m_Ring.Init(m_Depth);
+    }
+    if(m_Ring.Valid()) {
+      return;
+    }
+#else
+    (void)useUring;
+#endif
+    StartWorkers();
+  }
+
+  ~AsyncLoader() {
+    Wait();
+    {
+      std::lock_guard<std::mutex> lock(m_Lock);
+      m_Stop = true;
+    }
+    m_WorkReady.notify_all();
+    for(std::thread& t : m_Workers) {
+      t.join();
+    }
+  }
+
+  AsyncLoader(const AsyncLoader&) = delete;
+  AsyncLoader& operator=(const AsyncLoader&) = delete;
+
+  // True when reads go through io_uring rather than the thread pool.
+  bool UsingUring() const {
+#if defined(XO_ALLOC_IO_URING)
+    return m_Ring.Valid();
+#else
+    return false;
+#endif
+  }
+
+  // Opens path and queues a read of the whole file. Reads are held back
+  // until depth of them are queued, then submitted as one batch; Poll
+  // or Wait submits a smaller batch. callback runs from Poll or Wait;
+  // if it throws, that call throws, and the next one delivers the rest.
+  void Load(const char* path, LoadCallback callback, bool nulTerminate = false) {
+    Request* r = new Request;
+    r->Path = path;
+    r->Callback = std::move(callback);
+    r->Data = nullptr;
+    r->Size = 0;
+    r->Done = 0;
+    r->Error = 0;
+    r->Nul = nulTerminate;
+    r->Fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    if(r->Fd < 0) {
+      r->Error = errno;
+    } else if(fstat(r->Fd, &st) != 0) {
+      r->Error = errno;
+    } else if(!S_ISREG(st.st_mode) || st.st_size >= 0x7fffffff) {
+      r->Error = EINVAL;
+    } else {
+      r->Size = static_cast<size_t>(st.st_size);
+      r->Data = static_cast<char*>(m_Alloc->Malloc(r->Size + (r->Nul ? 1 : 0)));
+      if(!r->Data) {
+        r->Error = ENOMEM;
+      }
+    }
+
+    if(r->Error || r->Size == 0) {
+      m_Finished.push_back(r);
+      return;
+    }
+    m_Queued.push_back(r);
+    if(m_Queued.size() >= m_Depth) {
+      Submit();
+    }
+  }
+
+  std::future<Span> LoadFuture(const char* path, bool nulTerminate = false) {
+    std::shared_ptr<std::promise<Span> > promise = std::make_shared<std::promise<Span> >();
+    std::future<Span> future = promise->get_future();
+    Load(path, [promise](const LoadResult& r) { promise->set_value(r.File); }, nulTerminate);
+    return future;
+  }
+
+  // Submits queued reads and delivers whatever has completed without
+  // blocking. Returns the number of callbacks run.
+  uint32_t Poll() {
+    Submit();
+    Collect();
+    return Deliver();
+  }
+
+  // Blocks until every load so far has been delivered.
+  void Wait() {
+    for(;;) {
+      Submit();
+      Collect();
+      Deliver();
+      if(m_InFlight == 0) {
+        if(m_Queued.empty()) {
+          return;
+        }
+        continue; // reaping made room for more reads.
+      }
+      Block();
+    }
+  }
+
+  // Loads not yet delivered.
+  size_t Pending() const {
+    return m_Queued.size() + m_InFlight + m_Finished.size();
+  }
+
+private:
+  struct Request {
+    std::string Path;
+    LoadCallback Callback;
+    char* Data;
+    size_t Size;
+    size_t Done;
+    iovec Iov;
+    int Fd;
+    int Error;
+    bool Nul;
+  };
+
+  ALLOC* m_Alloc;
+  uint32_t m_Depth;
+  uint32_t m_InFlight;
+  std::deque<Request*> m_Queued;   // opened and allocated, not submitted
+  std::vector<Request*> m_Finished; // read or failed, not delivered
+
+#if defined(XO_ALLOC_IO_URING)
+  IoUring m_Ring;
+  std::vector<Request*> m_Ringed; // submitted to the ring, not reaped
+#endif
+
+  // thread pool fallback
+  uint32_t m_Threads;
+  std::vector<std::thread> m_Workers;
+  std::mutex m_Lock;
+  std::condition_variable m_WorkReady;
+  std::condition_variable m_DoneReady;
+  std::deque<Request*> m_Work;
+  std::vector<Request*> m_Done;
+  bool m_Stop;
+
+  void Submit() {
+#if defined(XO_ALLOC_IO_URING)
+    if(m_Ring.Valid()) {
+      uint32_t added = 0;
+      while(!m_Queued.empty() && m_InFlight < m_Depth) {
+        if(!PrepRead(m_Queued.front())) {
+          break;
+        }
+        m_Ringed.push_back(m_Queued.front());
+        m_Queued.pop_front();
+        m_InFlight++;
+        added++;
+      }
+      if(!added || m_Ring.Submit()) {
+        return;
+      }
+      FallBack();
+    }
+#endif
+    if(m_Queued.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_Lock);
+      m_InFlight += static_cast<uint32_t>(m_Queued.size());
+      m_Work.insert(m_Work.end(), m_Queued.begin(), m_Queued.end());
+    }
+    m_Queued.clear();
+    m_WorkReady.notify_all();
+  }
+
+  // Moves completed reads to m_Finished.
+  void Collect() {
+#if defined(XO_ALLOC_IO_URING)
+    if(m_Ring.Valid()) {
+      std::vector<Request*> again;
+      m_Ring.Reap([&](uint64_t user, int32_t res) {
+        Request* r = reinterpret_cast<Request*>(static_cast<uintptr_t>(user));
+        for(Request*& x : m_Ringed) {
+          if(x == r) {
+            x = m_Ringed.back();
+            m_Ringed.pop_back();
+            break;
+          }
+        }
+        if(res == -EINTR || res == -EAGAIN) {
+          again.push_back(r);
+          return;
+        }
+        if(res < 0) {
+          r->Error = -res;
+        } else {
+          r->Done += static_cast<size_t>(res);
+          // a short read that isn't end of file: read the rest.
+          if(res > 0 && r->Done < r->Size) {
+            again.push_back(r);
+            return;
+          }
+        }
+        m_InFlight--;
+        m_Finished.push_back(r);
+      });
+      // back to the front of the queue, ahead of anything new. They
+      // leave the in flight count, and Submit counts them again.
+      for(Request* r : again) {
+        m_InFlight--;
+        m_Queued.push_front(r);
+      }
+      return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_InFlight -= static_cast<uint32_t>(m_Done.size());
+    m_Finished.insert(m_Finished.end(), m_Done.begin(), m_Done.end());
+    m_Done.clear();
+  }
+
+  // Waits for at least one completion.
+  void Block() {
+#if defined(XO_ALLOC_IO_URING)
+    if(m_Ring.Valid()) {
+      if(m_Ring.Submit(1)) {
+        return;
+      }
+      FallBack();
+      Submit();
+    }
+#endif
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_DoneReady.wait(lock, [this] { return !m_Done.empty(); });
+  }
+
+  // A callback that throws has its request freed, and the rest go
+  // back on m_Finished for the next Poll or Wait before the exception
+  // propagates. The throwing callback's File.Data is its own.
+  uint32_t Deliver() {
+    std::vector<Request*> finished;
+    finished.swap(m_Finished);
+    for(size_t i = 0; i < finished.size(); ++i) {
+      Request* r = finished[i];
+      if(r->Fd >= 0) {
+        close(r->Fd);
+      }
+      LoadResult result;
+      result.Path = r->Path.c_str();
+      result.Error = r->Error;
+      result.File.Data = nullptr;
+      result.File.Size = 0;
+      if(r->Error) {
+        m_Alloc->Free(r->Data);
+      } else {
+        if(r->Nul) {
+          r->Data[r->Done] = '\0';
+        }
+        result.File.Data = r->Data;
+        result.File.Size = r->Done;
+      }
+      if(r->Callback) {
+        try {
+          r->Callback(result);
+        } catch(...) {
+          delete r;
+          m_Finished.insert(m_Finished.begin(), finished.begin() + i + 1, finished.end());
+          throw;
+        }
+      }
+      delete r;
+    }
+    return static_cast<uint32_t>(finished.size());
+  }
+
+#if defined(XO_ALLOC_IO_URING)
+  bool PrepRead(Request* r) {
+    io_uring_sqe* sqe = m_Ring.Next();
+    if(!sqe) {
+      return false;
+    }
+    // READV rather than READ: it's in every kernel with io_uring.
+    r->Iov.iov_base = r->Data + r->Done;
+    r->Iov.iov_len = r->Size - r->Done;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = r->Fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&r->Iov);
+    sqe->len = 1;
+    sqe->off = r->Done;
+    sqe->user_data = reinterpret_cast<uintptr_t>(r);
+    return true;
+  }
+
+  // io_uring_enter failed outright, so there's no telling which reads
+  // the kernel took. Closing the ring waits out or cancels them; then
+  // every unreaped read is redone from where it got to, on the pool.
+  void FallBack() {
+    m_Ring.Close();
+    m_Queued.insert(m_Queued.begin(), m_Ringed.begin(), m_Ringed.end());
+    m_InFlight -= static_cast<uint32_t>(m_Ringed.size());
+    m_Ringed.clear();
+    StartWorkers();
+  }
+#endif
+
+  void StartWorkers() {
+    uint32_t threads = m_Threads;
+    if(threads == 0) {
+      threads = std::thread::hardware_concurrency();
+      threads = threads ? threads : 4;
+    }
+    for(uint32_t i = 0; i < threads; ++i) {
+      m_Workers.push_back(std::thread(&AsyncLoader::Worker, this));
+    }
+  }
+
+  void Worker() {
+    for(;;) {
+      Request* r;
+      {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        m_WorkReady.wait(lock, [this] { return m_Stop || !m_Work.empty(); });
+        if(m_Work.empty()) {
+          return;
+        }
+        r = m_Work.front();
+        m_Work.pop_front();
+      }
+      while(r->Done < r->Size) {
+        ssize_t n = pread(r->Fd, r->Data + r->Done, r->Size - r->Done, static_cast<off_t>(r->Done));
+        if(n < 0 && errno == EINTR) {
+          continue;
+        }
+        if(n < 0) {
+          r->Error = errno;
+          break;
+        }
+        if(n == 0) {
+          break;
+        }
+        r->Done += static_cast<size_t>(n);
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Done.push_back(r);
+      }
+      m_DoneReady.notify_one();
+    }
+  }
+};
+
+XO_NAMESPACE_END
@@ -1,6 +1,6 @@
 //////////////////////////////////////////////////////////////////////
 //
-// xo-alloc.h (version 0.2, May 2017) public domain
+// xo-alloc.h (version 0.3, October 2026) public domain
 //
 // A public domain single header file module for allocating memory. 
 // C++11 or newer required.
@@ -18,6 +18,9 @@
 //   MyAlloc.Delete(apple);
 //   MyAlloc.Delete(banana);
 //
+//   The other allocators (pool, ring, linear, frame, double stack,
+//   child, generational) have their usage above their class.
+//
 // IMPLEMENTATION NOTES:
 //
 //   There's a buffer of memory specified as a template parameter. 
@@ -34,9 +37,18 @@
 //   "free" flag. This means the allocator is limited to be 2^31 
 //   bytes large.
 //
+//   Every chunk, header included, is a multiple of alignof(max_align_t)
+//   (16 bytes on most 64 bit targets), and the first header is placed
+//   so its payload is aligned. So every payload is aligned for any
+//   fundamental type, as malloc's are.
+//
 //   As memory is freed, we attempt to find other free buffers 
 //   adjacent and join them together.
 //
+// OPTIONS:
+//   #define XO_ALLOC_TRACE to record allocations (see TraceRecorder).
+//   #define XO_ALLOC_NO_FILE to leave out LoadFile and its includes.
+//
 // AUTHOR
 //   Jared Thomson <twitter: @xoorath> <email:jared@xoorath.com>
 //
@@ -45,12 +57,14 @@
 //   https://github.com/nothings
 //
 // VERSION HISTORY
+//   0.3  (2026-10-17) pool, ring, linear, frame, double stack, child
+//                     and generational allocators; size classes,
+//                     lifetime hints, tracing, LoadFile
 //   0.2  (2017-05-16) adding demo.cpp, public malloc/free, xo styling
 //   0.1  (2017-05-15) initial commit
 //
 // TODO 1.0
 //   - realloc, calloc, array new, array delete.
-//   - unit tests.
 //
 // LICENSE
 //   See end of file for license information.
@@ -69,57 +83,526 @@
 //////////////////////////////////////////////////////////////////////
 // xo-alloc.h declarations.
 
-#define XO_ALLOC_VER "0.2"
+#define XO_ALLOC_VER "0.3"
 
+#include <atomic>
+#include <cstddef>
 #include <new>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+#if defined(XO_ALLOC_TRACE)
+#include <chrono>
+#include <stdio.h>
+#include <unordered_map>
+#endif
+
+#if !defined(XO_ALLOC_NO_FILE)
+#if defined(__unix__) || defined(__APPLE__)
+#define XO_ALLOC_POSIX_FILE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <stdio.h>
+#endif
+#endif
 
 XO_NAMESPACE_BEGIN
 
-template<uint32_t SIZE>
-class BlockAllocator {
-  static_assert(SIZE < (1 << 31), "BlockAllocator doesn't support being larger than 1^31");
+////////////////////////////////////////////////////////////////////// BlockStats
+
+struct BlockStats {
+  uint32_t UsedBytes;    // payload bytes in allocated blocks
+  uint32_t FreeBytes;    // payload bytes in free blocks
+  uint32_t LargestFree;  // largest single allocation that can succeed
+  uint32_t UsedBlocks;
+  uint32_t FreeBlocks;
+
+  // 0 when all free memory is one block, approaching 1 as it shatters.
+  float Fragmentation() const {
+    return FreeBytes ? 1.0f - float(LargestFree) / float(FreeBytes) : 0.0f;
+  }
+};
+
+////////////////////////////////////////////////////////////////////// LoadFile
+
+#if !defined(XO_ALLOC_NO_FILE)
+
+// A file's contents in an allocator. Data is nullptr if the load failed.
+// Size never counts the NUL terminator.
+struct Span {
+  char* Data;
+  size_t Size;
+};
+
+// Reads a whole file into one allocation from alloc, which can be any
+// xo allocator with Malloc/Free. The allocation is sized from fstat and
+// filled with pread straight into the block, so there's no stdio buffer
+// copy in between (unbuffered stdio where there's no POSIX). Files
+// are always read, never mapped: the block is memory inside the
+// allocator. With nulTerminate the block is one byte larger and
+// Data[Size] is '\0'. Release it with alloc.Free(span.Data).
+template<typename ALLOC>
+Span LoadFileInto(ALLOC& alloc, const char* path, bool nulTerminate = false) {
+  Span s = { nullptr, 0 };
+  const size_t extra = nulTerminate ? 1 : 0;
+#if defined(XO_ALLOC_POSIX_FILE)
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    return s;
+  }
+  struct stat st;
+  // the allocators are limited to 2^31 bytes.
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size >= 0x7fffffff) {
+    close(fd);
+    return s;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  char* data = static_cast<char*>(alloc.Malloc(size + extra));
+  if(!data) {
+    close(fd);
+    return s;
+  }
+  size_t done = 0;
+  while(done < size) {
+    ssize_t r = pread(fd, data + done, size - done, static_cast<off_t>(done));
+    if(r < 0 && errno == EINTR) {
+      continue;
+    }
+    if(r < 0) {
+      close(fd);
+      alloc.Free(data);
+      return s;
+    }
+    if(r == 0) {
+      break; // the file shrank since fstat. keep what we got.
+    }
+    done += static_cast<size_t>(r);
+  }
+  close(fd);
+#else
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    return s;
+  }
+  long end = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+  if(end < 0 || end >= 0x7fffffff) {
+    fclose(f);
+    return s;
+  }
+  rewind(f);
+  size_t size = static_cast<size_t>(end);
+  char* data = static_cast<char*>(alloc.Malloc(size + extra));
+  if(!data) {
+    fclose(f);
+    return s;
+  }
+  // unbuffered, so fread goes straight into the block.
+  setvbuf(f, nullptr, _IONBF, 0);
+  size_t done = fread(data, 1, size, f);
+  bool failed = ferror(f) != 0;
+  fclose(f);
+  if(failed) {
+    alloc.Free(data);
+    return s;
+  }
+#endif
+  if(nulTerminate) {
+    data[done] = '\0';
+  }
+  s.Data = data;
+  s.Size = done;
+  return s;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////// Lifetime
+
+// How long an allocation is expected to live. BlockAllocator places
+// short lived blocks first fit from the start of its buffer and the
+// rest last fit from the end, so blocks that outlive their neighbours
+// aren't left stranded in the middle of freed space.
+//
+//   Texture* tex = Arena.NewFor<Texture>(LifetimeLong);
+//   void* table = Arena.Malloc(4096, LifetimePermanent);
+//
+// Last fit walks every block, so a hinted allocation costs a full
+// scan. Permanent is placed like Long; traces keep the difference.
+enum Lifetime {
+  LifetimeShort,    // the default: scratch, per frame, per request
+  LifetimeLong,     // outlives most of what's allocated around it
+  LifetimePermanent // never freed, or only at shutdown
+};
+
+////////////////////////////////////////////////////////////////////// TraceRecorder
+
+enum TraceOp {
+  TraceMalloc = 1,
+  TraceFree   = 2,
+  TraceNew    = 3,
+  TraceDelete = 4
+};
+
+#if defined(XO_ALLOC_TRACE)
+
+enum TraceFlags {
+  TraceFailed    = 1 << 0, // the allocation returned nullptr. id is 0.
+  TraceLong      = 1 << 1, // allocated with LifetimeLong
+  TracePermanent = 1 << 2  // allocated with LifetimePermanent
+};
+
+inline uint8_t TraceLifetimeFlags(Lifetime hint) {
+  return hint == LifetimeLong ? TraceLong : hint == LifetimePermanent ? TracePermanent : 0;
+}
+
+inline Lifetime TraceLifetime(uint8_t flags) {
+  return (flags & TracePermanent) ? LifetimePermanent : (flags & TraceLong) ? LifetimeLong : LifetimeShort;
+}
+
+struct TraceRecord {
+  uint64_t Time;  // nanoseconds since the recorder was created
+  uint32_t Id;
+  uint32_t Size;  // as requested; a free repeats its allocation's
+  uint16_t Align; // 0 for Malloc/Free, which make no alignment promise
+  uint8_t Op;
+  uint8_t Flags;
+};
+
+static const uint32_t TraceVersion = 1;
+static const size_t TraceHeaderSize = 8;
+static const size_t TraceRecordSize = 20;
+
+// Writes every Malloc/Free/New/Delete of the allocators it's given to
+// a compact binary log, for bench/replay.cpp to play back:
+//
+//   FILE* f = fopen("alloc.xotrace", "wb");
+//   xo::TraceRecorder Recorder(f);
+//   Arena.SetTraceRecorder(&Recorder);
+//
+// The log is an 8 byte header ("XOAT" + uint32 version) followed by
+// TraceRecords, native endian. Ids are assigned on allocation and
+// repeated, with the requested size, on the matching free. Without XO_ALLOC_TRACE the hooks
+// compile away to nothing.
+class TraceRecorder {
 public:
+  explicit TraceRecorder(FILE* out)
+    : m_Out(out)
+    , m_NextId(1)
+    , m_Start(std::chrono::steady_clock::now()) {
+    char header[TraceHeaderSize] = { 'X', 'O', 'A', 'T' };
+    memcpy(header+4, &TraceVersion, 4);
+    fwrite(header, 1, TraceHeaderSize, m_Out);
+  }
 
-  ////////////////////////////////////////////////////////////////////// BlockAllocator API
+  ~TraceRecorder() {
+    fflush(m_Out);
+  }
 
-  template<typename T, typename...Args>
-  T* New(Args...args) {
-    void* mem = static_cast<void*>(InternalMallocT<sizeof(T)>());
-    return mem ? new(mem) T(args...) : nullptr;
+  void Record(uint8_t op, uint32_t size, uint32_t align, const void* mem, uint8_t flags = 0) {
+    TraceRecord r;
+    r.Time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - m_Start).count());
+    r.Size = size;
+    r.Align = static_cast<uint16_t>(align);
+    r.Op = op;
+    r.Flags = flags;
+
+    if(op == TraceMalloc || op == TraceNew) {
+      if(mem) {
+        r.Id = m_NextId++;
+        Live& live = m_Live[mem];
+        live.Id = r.Id;
+        live.Size = size;
+      } else {
+        r.Id = 0;
+        r.Flags |= TraceFailed;
+      }
+    } else {
+      // frees of pointers we never saw allocated are not recorded.
+      // the allocator only knows the rounded size of what's freed.
+      auto it = m_Live.find(mem);
+      if(it == m_Live.end()) {
+        return;
+      }
+      r.Id = it->second.Id;
+      r.Size = it->second.Size;
+      m_Live.erase(it);
+    }
+
+    char buf[TraceRecordSize];
+    memcpy(buf+0, &r.Time, 8);
+    memcpy(buf+8, &r.Id, 4);
+    memcpy(buf+12, &r.Size, 4);
+    memcpy(buf+16, &r.Align, 2);
+    buf[18] = static_cast<char>(r.Op);
+    buf[19] = static_cast<char>(r.Flags);
+    fwrite(buf, 1, TraceRecordSize, m_Out);
   }
 
-  template<typename T>
-  void Delete(T* m) {
-    if(m) {
-      m->~T();
-      InternalFree(static_cast<void*>(m));
+private:
+  struct Live {
+    uint32_t Id;
+    uint32_t Size;
+  };
+
+  FILE* m_Out;
+  uint32_t m_NextId;
+  std::chrono::steady_clock::time_point m_Start;
+  std::unordered_map<const void*, Live> m_Live;
+};
+
+// Returns false if the stream isn't an xo-alloc trace of a version we read.
+inline bool ReadTraceHeader(FILE* in) {
+  char header[TraceHeaderSize];
+  uint32_t version;
+  if(fread(header, 1, TraceHeaderSize, in) != TraceHeaderSize || memcmp(header, "XOAT", 4) != 0) {
+    return false;
+  }
+  memcpy(&version, header+4, 4);
+  return version == TraceVersion;
+}
+
+// Returns false at the end of the stream.
+inline bool ReadTraceRecord(FILE* in, TraceRecord* r) {
+  char buf[TraceRecordSize];
+  if(fread(buf, 1, TraceRecordSize, in) != TraceRecordSize) {
+    return false;
+  }
+  memcpy(&r->Time, buf+0, 8);
+  memcpy(&r->Id, buf+8, 4);
+  memcpy(&r->Size, buf+12, 4);
+  memcpy(&r->Align, buf+16, 2);
+  r->Op = static_cast<uint8_t>(buf[18]);
+  r->Flags = static_cast<uint8_t>(buf[19]);
+  return true;
+}
+#endif
+
+// The allocators' side of tracing: the recorder they write to, and the
+// Trace call that does nothing, and holds nothing, unless
+// XO_ALLOC_TRACE is defined.
+class TraceSink {
+public:
+#if defined(XO_ALLOC_TRACE)
+  // Pass nullptr to stop recording.
+  void SetTraceRecorder(TraceRecorder* recorder) {
+    m_Trace = recorder;
+  }
+#endif
+
+protected:
+#if defined(XO_ALLOC_TRACE)
+  TraceSink() : m_Trace(nullptr) {}
+#endif
+
+  void Trace(uint8_t op, size_t size, uint32_t align, const void* mem) {
+#if defined(XO_ALLOC_TRACE)
+    if(m_Trace) {
+      m_Trace->Record(op, static_cast<uint32_t>(size), align, mem);
     }
+#else
+    (void)op; (void)size; (void)align; (void)mem;
+#endif
   }
 
-  void* Malloc(size_t size) {
-    return InternalMalloc(size);
+  void Trace(uint8_t op, size_t size, uint32_t align, const void* mem, Lifetime hint) {
+#if defined(XO_ALLOC_TRACE)
+    if(m_Trace) {
+      m_Trace->Record(op, static_cast<uint32_t>(size), align, mem, TraceLifetimeFlags(hint));
+    }
+#else
+    (void)op; (void)size; (void)align; (void)mem; (void)hint;
+#endif
   }
 
-  void Free(void* m) {
-    if(m) {
-      InternalFree(m);
+private:
+#if defined(XO_ALLOC_TRACE)
+  TraceRecorder* m_Trace;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////// SizeClasses
+
+// Block sizes a BlockAllocator keeps free lists for, smallest first.
+// Each must be at least 4 bytes. SizeClasses<> (the default) has none.
+//
+//   BlockAllocator<1 << 20, SizeClasses<16, 32, 64, 128> > Small;
+//
+// A freed block of exactly a class's size goes on that class's list,
+// linked through a 4 byte offset in the block, instead of back into
+// the block list. New<T> and Delete<T> find the class at compile time,
+// so for a small T they're a pop or a push. Listed blocks count as
+// used in GetStats until FlushBins. bench/sizeclass-gen.cpp picks the
+// classes from a trace.
+template<uint32_t...SIZES>
+struct SizeClasses {
+  static const uint32_t Count = sizeof...(SIZES);
+  static constexpr uint32_t Sizes[Count + 1] = { SIZES..., 0 };
+
+  // The smallest class that holds size, or Count if none does.
+  static constexpr uint32_t Find(uint32_t size, uint32_t i = 0) {
+    return i == Count || Sizes[i] >= size ? i : Find(size, i + 1);
+  }
+
+  // The class that is exactly size, or Count.
+  static constexpr uint32_t FindExact(uint32_t size, uint32_t i = 0) {
+    return i == Count || Sizes[i] == size ? i : FindExact(size, i + 1);
+  }
+
+  static constexpr bool Valid(uint32_t i = 0) {
+    return i + 1 >= Count || (Sizes[i] >= sizeof(uint32_t) && Sizes[i] < Sizes[i + 1] && Valid(i + 1));
+  }
+};
+
+template<uint32_t...SIZES>
+constexpr uint32_t SizeClasses<SIZES...>::Sizes[];
+
+////////////////////////////////////////////////////////////////////// ArenaPtr
+
+// A pointer into one arena, kept as a 32 bit offset from the arena's
+// base: half the size of a T* on 64 bit targets. It's resolved against
+// the base it was made with (BlockAllocator::Ptr and Resolve do both),
+// so it stays valid if the whole arena is copied or mapped elsewhere.
+// Offset 0 is null. That's alignment padding in a BlockAllocator, never
+// an allocation, which is why only BlockAllocator hands these out.
+template<typename T>
+class ArenaPtr {
+public:
+  ArenaPtr() : m_Offset(0) {}
+  ArenaPtr(decltype(nullptr)) : m_Offset(0) {}
+
+  ArenaPtr(const void* base, T* p)
+    : m_Offset(p ? static_cast<uint32_t>(reinterpret_cast<const char*>(p) - static_cast<const char*>(base)) : 0) {}
+
+  T* Get(const void* base) const {
+    return m_Offset ? reinterpret_cast<T*>(const_cast<char*>(static_cast<const char*>(base)) + m_Offset) : nullptr;
+  }
+
+  uint32_t Offset() const { return m_Offset; }
+  explicit operator bool() const { return m_Offset != 0; }
+
+  bool operator==(const ArenaPtr& o) const { return m_Offset == o.m_Offset; }
+  bool operator!=(const ArenaPtr& o) const { return m_Offset != o.m_Offset; }
+
+private:
+  uint32_t m_Offset;
+};
+
+// Links for an ArenaList, embedded in the element.
+template<typename T>
+struct ArenaLink {
+  ArenaPtr<T> Next;
+  ArenaPtr<T> Prev;
+};
+
+// An intrusive doubly linked list of elements in one arena, linked by
+// ArenaPtrs through the element's LINK member:
+//
+//   struct Node { int Value; ArenaLink<Node> Link; };  // 12 bytes
+//   ArenaList<Node, &Node::Link> list(Arena.Base());
+//   list.PushBack(Arena.New<Node>());
+//   for(Node* n = list.Front(); n; n = list.Next(n)) { ... }
+//
+// The list doesn't own its elements; Remove them before freeing them.
+template<typename T, ArenaLink<T> T::*LINK>
+class ArenaList {
+public:
+  explicit ArenaList(const void* base) : m_Base(base), m_Size(0) {}
+
+  T* Front() const { return m_Head.Get(m_Base); }
+  T* Back() const { return m_Tail.Get(m_Base); }
+  T* Next(const T* t) const { return (t->*LINK).Next.Get(m_Base); }
+  T* Prev(const T* t) const { return (t->*LINK).Prev.Get(m_Base); }
+
+  bool Empty() const { return !m_Head; }
+  uint32_t Size() const { return m_Size; }
+
+  void PushFront(T* t) {
+    ArenaPtr<T> p(m_Base, t);
+    (t->*LINK).Prev = nullptr;
+    (t->*LINK).Next = m_Head;
+    if(T* head = Front()) {
+      (head->*LINK).Prev = p;
+    } else {
+      m_Tail = p;
     }
+    m_Head = p;
+    m_Size++;
   }
 
-  BlockAllocator() {
-    Block* b = reinterpret_cast<Block*>(m_Buffer);
-    b->Free = true;
-    b->Size = SIZE - sizeof(Block);
+  void PushBack(T* t) {
+    ArenaPtr<T> p(m_Base, t);
+    (t->*LINK).Next = nullptr;
+    (t->*LINK).Prev = m_Tail;
+    if(T* tail = Back()) {
+      (tail->*LINK).Next = p;
+    } else {
+      m_Head = p;
+    }
+    m_Tail = p;
+    m_Size++;
+  }
+
+  void Remove(T* t) {
+    ArenaLink<T>& link = t->*LINK;
+    if(T* prev = link.Prev.Get(m_Base)) {
+      (prev->*LINK).Next = link.Next;
+    } else {
+      m_Head = link.Next;
+    }
+    if(T* next = link.Next.Get(m_Base)) {
+      (next->*LINK).Prev = link.Prev;
+    } else {
+      m_Tail = link.Prev;
+    }
+    link.Next = nullptr;
+    link.Prev = nullptr;
+    m_Size--;
+  }
+
+  T* PopFront() {
+    T* t = Front();
+    if(t) {
+      Remove(t);
+    }
+    return t;
   }
 
 private:
-  ////////////////////////////////////////////////////////////////////// BlockAllocator Internal
+  const void* m_Base;
+  ArenaPtr<T> m_Head;
+  ArenaPtr<T> m_Tail;
+  uint32_t m_Size;
+};
 
-  char m_Buffer[SIZE];
+////////////////////////////////////////////////////////////////////// BlockCore
+
+#if defined(_MSC_VER)
+#define XO_ALLOC_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__) || defined(__clang__)
+#define XO_ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define XO_ALLOC_NOINLINE
+#endif
 
-  void* Begin() { return static_cast<void*>(m_Buffer); }
-  void* End() { return static_cast<void*>(static_cast<char*>(m_Buffer)+SIZE); }
+// The block list algorithms behind BlockAllocator, over a buffer given
+// at runtime. None of it depends on SIZE, so every BlockAllocator<SIZE>
+// shares this one copy instead of instantiating its own. The walks are
+// kept out of line, or the compiler would paste them back into each
+// instantiation; a call is nothing next to the walk.
+//
+// Every block, header and payload, is a multiple of Align bytes, and
+// the first header sits Align - 4 bytes into an Align boundary, so
+// every payload is aligned for any fundamental type.
+class BlockCore {
+public:
+  static const uint32_t Align = alignof(std::max_align_t);
 
   struct Block {
     bool Free:1;
@@ -137,6 +620,139 @@ private:
     }
   };
 
+  // The payload a request for size bytes gets: with its header,
+  // rounded up to a multiple of Align.
+  static constexpr uint32_t Round(uint32_t size) {
+    return ((size + uint32_t(sizeof(Block)) + Align - 1) & ~(Align - 1)) - uint32_t(sizeof(Block));
+  }
+
+  // Makes the whole buffer one free block. It needs room for the
+  // alignment padding and one block: 2 * Align bytes is always enough.
+  static void Init(char* base, uint32_t bytes) {
+    Block* b = First(base);
+    b->Free = true;
+    b->Size = static_cast<uint32_t>(reinterpret_cast<char*>(End(base, bytes)) - reinterpret_cast<char*>(b + 1));
+  }
+
+  XO_ALLOC_NOINLINE static void* Malloc(char* base, uint32_t bytes, uint32_t size, Lifetime hint) {
+    if(size >= bytes) {
+      return nullptr;
+    }
+    size = Round(size);
+    Block* i = First(base);
+    Block* e = End(base, bytes);
+    if(hint == LifetimeShort) {
+      for(;i < e; i = i->Next()) {
+        if(i->Free && i->Size >= size) {
+          return Carve(i, size);
+        }
+      }
+      return nullptr;
+    }
+    // last fit: the free block nearest the end, carved from its end.
+    Block* last = nullptr;
+    for(;i < e; i = i->Next()) {
+      if(i->Free && i->Size >= size) {
+        last = i;
+      }
+    }
+    return last ? CarveEnd(last, size) : nullptr;
+  }
+
+  // The fitting free block nearest to near wins. One before near is
+  // carved from its end and one after from its start, so the new block
+  // lands on the side facing near.
+  XO_ALLOC_NOINLINE static void* MallocNear(char* base, uint32_t bytes, uint32_t size, const void* near) {
+    const char* n = static_cast<const char*>(near);
+    if(n < base || n >= base + bytes || size >= bytes) {
+      return Malloc(base, bytes, size, LifetimeShort);
+    }
+    size = Round(size);
+    Block* best = nullptr;
+    uintptr_t bestDist = UINTPTR_MAX;
+    Block* i = First(base);
+    Block* e = End(base, bytes);
+    for(;i < e; i = i->Next()) {
+      const char* start = reinterpret_cast<const char*>(i);
+      // every block from here on is further away than best.
+      if(start > n && uintptr_t(start - n) >= bestDist) {
+        break;
+      }
+      if(i->Free && i->Size >= size) {
+        const char* end = reinterpret_cast<const char*>(i->Next());
+        uintptr_t dist = end <= n ? uintptr_t(n - end) : start > n ? uintptr_t(start - n) : 0;
+        if(dist < bestDist) {
+          best = i;
+          bestDist = dist;
+        }
+      }
+    }
+    if(!best) {
+      return nullptr;
+    }
+    return reinterpret_cast<const char*>(best) < n ? CarveEnd(best, size) : Carve(best, size);
+  }
+
+  XO_ALLOC_NOINLINE static void Free(char* base, uint32_t bytes, void* mem) {
+    Block* m = reinterpret_cast<Block*>(mem)-1;
+    Block* i = First(base);
+    Block* e = End(base, bytes);
+
+    if(m < i || m >= e) {
+      return;
+    }
+    m->Free = true;
+    JoinBlocks(i, e, m);
+  }
+
+  XO_ALLOC_NOINLINE static BlockStats GetStats(const char* base, uint32_t bytes) {
+    BlockStats s = {};
+    const Block* i = First(base);
+    const Block* e = End(base, bytes);
+    for(;i < e; i = i->Next()) {
+      if(i->Free) {
+        s.FreeBytes += i->Size;
+        s.FreeBlocks++;
+        if(i->Size > s.LargestFree) {
+          s.LargestFree = i->Size;
+        }
+      } else {
+        s.UsedBytes += i->Size;
+        s.UsedBlocks++;
+      }
+    }
+    return s;
+  }
+
+  static uint32_t SizeOf(const void* mem) {
+    return (reinterpret_cast<const Block*>(mem)-1)->Size;
+  }
+
+  // True if mem is between the first block's payload and the end of
+  // the last block. The alignment padding and first header aren't.
+  static bool Contains(const char* base, uint32_t bytes, const void* mem) {
+    const char* c = static_cast<const char*>(mem);
+    return c >= reinterpret_cast<const char*>(First(base) + 1) && c < reinterpret_cast<const char*>(End(base, bytes));
+  }
+
+private:
+  // Bytes of padding before the first header, so its payload is aligned.
+  static uint32_t Lead(const char* base) {
+    uintptr_t payload = reinterpret_cast<uintptr_t>(base) + sizeof(Block);
+    return static_cast<uint32_t>((Align - payload % Align) % Align);
+  }
+
+  static Block* First(const char* base) {
+    return reinterpret_cast<Block*>(const_cast<char*>(base) + Lead(base));
+  }
+
+  // Just past the last block: the buffer's end, less what's left over
+  // from a whole number of Align sized steps.
+  static Block* End(const char* base, uint32_t bytes) {
+    uint32_t lead = Lead(base);
+    return reinterpret_cast<Block*>(const_cast<char*>(base) + lead + (bytes - lead) / Align * Align);
+  }
+
   static void JoinBlocks(Block* b, Block* e, Block* m) {
     if(m->Free) {
       Block* n = m->Next();
@@ -155,50 +771,1741 @@ private:
     }
   }
 
-  void* InternalMalloc(uint32_t size) {
-    Block* i = static_cast<Block*>(Begin());
-    Block* e = static_cast<Block*>(End());
-    for(;i < e; i = i->Next()) {
-      if(i->Free && i->Size >= size) {
-        i->Free = false;
-        intptr_t oldSize = i->Size;
-        i->Size = size;
-        Block* n = i->Next();
-        intptr_t nextSize = (oldSize-size-sizeof(Block));
-        // if there's not enough space for the next block (meaning n is invalid)
-        if(nextSize <= sizeof(Block)) {
-          i->Size += nextSize + sizeof(Block);
-          n = i;
-        }
-        // otherwise, break our block in half, creating a new next block. 
-        else {
-          n->Free = true;
-          n->Size = nextSize;
-        }
-        return reinterpret_cast<char*>(i+1);
-      }
+  // Allocates size bytes from the start of free block i, splitting off
+  // what's left as a new free block if it's worth keeping.
+  static void* Carve(Block* i, uint32_t size) {
+    i->Free = false;
+    intptr_t oldSize = i->Size;
+    i->Size = size;
+    Block* n = i->Next();
+    intptr_t nextSize = oldSize - intptr_t(size) - intptr_t(sizeof(Block));
+    // if there's not enough space for the next block (meaning n is invalid)
+    if(nextSize <= intptr_t(sizeof(Block))) {
+      i->Size += nextSize + sizeof(Block);
+      n = i;
+    }
+    // otherwise, break our block in half, creating a new next block. 
+    else {
+      n->Free = true;
+      n->Size = nextSize;
     }
-    return nullptr;
+    return reinterpret_cast<char*>(i+1);
   }
 
-  template<uint32_t size>
-  void* InternalMallocT() {
-    static_assert(size < SIZE-sizeof(Block), "Allocation requested is larger than the allocator.");
-    return InternalMalloc(size);
+  // As Carve, but from the end of i: i stays free with what's left.
+  static void* CarveEnd(Block* i, uint32_t size) {
+    intptr_t leftSize = intptr_t(i->Size) - intptr_t(size) - intptr_t(sizeof(Block));
+    if(leftSize <= intptr_t(sizeof(Block))) {
+      i->Free = false;
+      return reinterpret_cast<char*>(i+1);
+    }
+    i->Size = static_cast<uint32_t>(leftSize);
+    Block* n = i->Next();
+    n->Free = false;
+    n->Size = size;
+    return reinterpret_cast<char*>(n+1);
   }
+};
 
-  void InternalFree(void* mem) {
-    Block* m = reinterpret_cast<Block*>(mem)-1;
-    Block* i = static_cast<Block*>(Begin());
-    Block* e = static_cast<Block*>(End());
+////////////////////////////////////////////////////////////////////// BlockAllocator
 
-    if(m < i || m > e) {
-      return;
+template<uint32_t SIZE, typename CLASSES = SizeClasses<> >
+class BlockAllocator : public TraceSink {
+  static_assert(SIZE < (1 << 31), "BlockAllocator doesn't support being larger than 1^31");
+  static_assert(SIZE >= 2 * BlockCore::Align, "BlockAllocator needs room for at least one block");
+  static_assert(CLASSES::Valid(), "Size classes must be at least 4 bytes and in increasing order.");
+public:
+
+  ////////////////////////////////////////////////////////////////////// BlockAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    return NewFor<T>(LifetimeShort, args...);
+  }
+
+  // New with a lifetime hint. See Lifetime.
+  template<typename T, typename...Args>
+  T* NewFor(Lifetime hint, Args...args) {
+    static_assert(alignof(T) <= BlockCore::Align, "BlockAllocator blocks aren't aligned enough for this type");
+    void* mem = static_cast<void*>(InternalMallocT<sizeof(T)>(hint));
+    Trace(TraceNew, sizeof(T), alignof(T), mem, hint);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m, LifetimeShort);
+      InternalFreeBin(static_cast<void*>(m), BinTag<CLASSES::Find(sizeof(T))>());
     }
-    m->Free = true;
-    JoinBlocks(i, e, m);
   }
-};
+
+  void* Malloc(size_t size, Lifetime hint = LifetimeShort) {
+    void* mem = InternalMallocBin(size, hint);
+    Trace(TraceMalloc, size, 0, mem, hint);
+    return mem;
+  }
+
+  // New, placed in the free block closest to near, which should be a
+  // block from this allocator. For objects that are traversed together:
+  // pass a node's parent, or an entity for its components. Falls back
+  // to normal placement when near is null or isn't ours. The walk stops
+  // once blocks are further past near than the best so far.
+  template<typename T, typename...Args>
+  T* NewNear(const void* near, Args...args) {
+    static_assert(alignof(T) <= BlockCore::Align, "BlockAllocator blocks aren't aligned enough for this type");
+    void* mem = InternalMallocNear(sizeof(T), near);
+    Trace(TraceNew, sizeof(T), alignof(T), mem, LifetimeShort);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  void* MallocNear(const void* near, size_t size) {
+    void* mem = InternalMallocNear(size, near);
+    Trace(TraceMalloc, size, 0, mem, LifetimeShort);
+    return mem;
+  }
+
+  // Pointers from elsewhere are ignored; their header isn't read.
+  void Free(void* m) {
+    if(Owns(m)) {
+      Trace(TraceFree, 0, 0, m, LifetimeShort);
+      InternalFreeBin(m, BinOfBlock(BlockCore::SizeOf(m)));
+    }
+  }
+
+  // True if m is inside the blocks: past the first header, not in the
+  // alignment padding before it or the leftover after the last.
+  bool Owns(const void* m) const {
+    return BlockCore::Contains(m_Buffer, SIZE, m);
+  }
+
+  // Returns every block held in the size class free lists to the
+  // general free space, joining it with its neighbours.
+  void FlushBins() {
+    for(uint32_t bin = 0; bin < CLASSES::Count; ++bin) {
+      while(void* mem = PopBin(bin)) {
+        InternalFree(mem);
+      }
+    }
+  }
+
+  // Caps the bytes the size class free lists may hold. 0, the default,
+  // is no cap. With one, each class gets a share of budget in
+  // proportion to its recent demand, recomputed every RebalanceEvery
+  // frees, and blocks freed past a class's share go back to the general
+  // free space. A class the workload has moved away from gives its
+  // blocks up instead of hoarding them.
+  void SetBinBudget(uint32_t budget) {
+    m_BinBudget = budget;
+    m_BinFrees = 0;
+    if(budget) {
+      Rebalance();
+    }
+  }
+
+  uint32_t BinBudget() const { return m_BinBudget; }
+
+  // Blocks the free list of class bin holds, and its current cap.
+  uint32_t BinHeld(uint32_t bin) const { return m_Bins[bin].Held; }
+  uint32_t BinCap(uint32_t bin) const { return m_Bins[bin].Cap; }
+
+  static const uint32_t RebalanceEvery = 4096;
+
+#if !defined(XO_ALLOC_NO_FILE)
+  // See LoadFileInto. Free the result with Free(span.Data).
+  Span LoadFile(const char* path, bool nulTerminate = false) {
+    return LoadFileInto(*this, path, nulTerminate);
+  }
+#endif
+
+  BlockStats GetStats() const {
+    return BlockCore::GetStats(m_Buffer, SIZE);
+  }
+
+  // Compact pointers into this allocator. See ArenaPtr.
+  template<typename T>
+  ArenaPtr<T> Ptr(T* p) const { return ArenaPtr<T>(m_Buffer, p); }
+
+  template<typename T>
+  T* Resolve(ArenaPtr<T> p) const { return p.Get(m_Buffer); }
+
+  const char* Base() const { return m_Buffer; }
+
+  BlockAllocator() {
+    BlockCore::Init(m_Buffer, SIZE);
+    for(Bin& bin : m_Bins) {
+      bin.Head = 0;
+      bin.Held = 0;
+      bin.Cap = UINT32_MAX;
+      bin.Demand = 0;
+    }
+    m_BinBudget = 0;
+    m_BinFrees = 0;
+  }
+
+private:
+  ////////////////////////////////////////////////////////////////////// BlockAllocator Internal
+
+  struct Bin {
+    uint32_t Head;   // first block, as an offset into m_Buffer. 0 is
+                     // empty: no payload starts there.
+    uint32_t Held;   // blocks on the list
+    uint32_t Cap;    // most blocks it may hold
+    uint32_t Demand; // allocations since the last rebalance, decayed
+  };
+
+  alignas(BlockCore::Align) char m_Buffer[SIZE];
+  Bin m_Bins[CLASSES::Count + 1];
+  uint32_t m_BinBudget;
+  uint32_t m_BinFrees;
+
+  template<uint32_t BIN>
+  struct BinTag {};
+  typedef BinTag<CLASSES::Count> NoBin;
+
+  template<uint32_t size>
+  void* InternalMallocT(Lifetime hint) {
+    static_assert(size < SIZE-sizeof(BlockCore::Block), "Allocation requested is larger than the allocator.");
+    return InternalMallocT<size>(hint, BinTag<CLASSES::Find(size)>());
+  }
+
+  template<uint32_t size, uint32_t BIN>
+  void* InternalMallocT(Lifetime hint, BinTag<BIN>) {
+    return MallocFromBin(BIN, hint);
+  }
+
+  template<uint32_t size>
+  void* InternalMallocT(Lifetime hint, NoBin) {
+    return InternalMalloc(size, hint);
+  }
+
+  // Malloc's runtime version of the same.
+  void* InternalMallocBin(size_t size, Lifetime hint) {
+    uint32_t bin = CLASSES::Find(static_cast<uint32_t>(size));
+    if(bin >= CLASSES::Count) {
+      return InternalMalloc(static_cast<uint32_t>(size), hint);
+    }
+    return MallocFromBin(bin, hint);
+  }
+
+  // Pops the class's free list, or carves a block of the class size so
+  // it can go on the list when it's freed.
+  void* MallocFromBin(uint32_t bin, Lifetime hint) {
+    m_Bins[bin].Demand++;
+    if(hint == LifetimeShort) {
+      if(void* mem = PopBin(bin)) {
+        return mem;
+      }
+    }
+    return InternalMalloc(CLASSES::Sizes[bin], hint);
+  }
+
+  void* PopBin(uint32_t bin) {
+    Bin& b = m_Bins[bin];
+    if(!b.Head) {
+      return nullptr;
+    }
+    char* mem = m_Buffer + b.Head;
+    memcpy(&b.Head, mem, sizeof(uint32_t));
+    b.Held--;
+    return mem;
+  }
+
+  // Splits m_BinBudget between the classes by bytes demanded since the
+  // last time, trims lists over their new cap and halves the demand
+  // counts, so older demand fades out.
+  void Rebalance() {
+    uint64_t total = 0;
+    for(uint32_t bin = 0; bin < CLASSES::Count; ++bin) {
+      total += uint64_t(m_Bins[bin].Demand) * CLASSES::Sizes[bin];
+    }
+    for(uint32_t bin = 0; bin < CLASSES::Count; ++bin) {
+      Bin& b = m_Bins[bin];
+      uint64_t share = total ? uint64_t(m_BinBudget) * b.Demand * CLASSES::Sizes[bin] / total
+        : m_BinBudget / CLASSES::Count;
+      b.Cap = static_cast<uint32_t>(share / CLASSES::Sizes[bin]);
+      while(b.Held > b.Cap) {
+        InternalFree(PopBin(bin));
+      }
+      b.Demand /= 2;
+    }
+  }
+
+  // The class whose blocks are size bytes, or Count. Classes less than
+  // Align apart can share a block size; the first of them gets it.
+  static uint32_t BinOfBlock(uint32_t size) {
+    uint32_t bin = CLASSES::Find(size >= BlockCore::Align ? size - BlockCore::Align + 1 : 0);
+    return bin < CLASSES::Count && BlockCore::Round(CLASSES::Sizes[bin]) == size ? bin : CLASSES::Count;
+  }
+
+  // Blocks that are exactly a class's block size go on its free list,
+  // still marked used; anything else (a split left too little to keep,
+  // or a block from NewNear) is freed as usual.
+  template<uint32_t BIN>
+  void InternalFreeBin(void* mem, BinTag<BIN>) {
+    InternalFreeBin(mem, BIN);
+  }
+
+  void InternalFreeBin(void* mem, NoBin) {
+    InternalFree(mem);
+  }
+
+  void InternalFreeBin(void* mem, uint32_t bin) {
+    char* m = static_cast<char*>(mem);
+    if(bin >= CLASSES::Count || !Owns(m) ||
+       BlockCore::SizeOf(m) != BlockCore::Round(CLASSES::Sizes[bin])) {
+      InternalFree(mem);
+      return;
+    }
+    Bin& b = m_Bins[bin];
+    if(m_BinBudget) {
+      if(++m_BinFrees >= RebalanceEvery) {
+        m_BinFrees = 0;
+        Rebalance();
+      }
+      if(b.Held >= b.Cap) {
+        InternalFree(mem);
+        return;
+      }
+    }
+    memcpy(m, &b.Head, sizeof(uint32_t));
+    b.Head = static_cast<uint32_t>(m - m_Buffer);
+    b.Held++;
+  }
+
+  void* InternalMalloc(uint32_t size, Lifetime hint) {
+    return BlockCore::Malloc(m_Buffer, SIZE, size, hint);
+  }
+
+  void* InternalMallocNear(uint32_t size, const void* near) {
+    return BlockCore::MallocNear(m_Buffer, SIZE, size, near);
+  }
+
+  void InternalFree(void* mem) {
+    BlockCore::Free(m_Buffer, SIZE, mem);
+  }
+};
+
+////////////////////////////////////////////////////////////////////// ChildAllocator
+
+// A block allocator inside a single allocation of a parent: a
+// BlockAllocator, or another ChildAllocator. For nested scopes (talloc
+// style), where everything a scope allocated goes at once:
+//
+//   ChildAllocator* request = ChildAllocator::Create(Arena, 64 << 10);
+//   ChildAllocator* op = ChildAllocator::Create(*request, 8 << 10);
+//   char* temp = static_cast<char*>(op->Malloc(512));
+//   request->Release(); // op and temp go with it
+//
+// The ChildAllocator lives at the front of its own region. Release is
+// one Free on the parent however much was allocated inside, and the
+// descendants aren't visited at all: their regions are inside this
+// one. Every pointer into the region, descendants included, is invalid
+// after. The block list is BlockCore's, so it costs no more code than
+// one more BlockAllocator.
+class ChildAllocator : public TraceSink {
+public:
+  ////////////////////////////////////////////////////////////////////// ChildAllocator API
+
+  // Takes size bytes from parent, this header included. nullptr if the
+  // parent doesn't have them.
+  template<typename PARENT>
+  static ChildAllocator* Create(PARENT& parent, uint32_t size) {
+    if(size < sizeof(ChildAllocator) + alignof(ChildAllocator) + 2 * BlockCore::Align || size >= (1u << 31)) {
+      return nullptr;
+    }
+    void* mem = parent.Malloc(size);
+    if(!mem) {
+      return nullptr;
+    }
+    // the parent's blocks may be less aligned than this header.
+    uintptr_t at = reinterpret_cast<uintptr_t>(mem);
+    uintptr_t pad = (alignof(ChildAllocator) - at % alignof(ChildAllocator)) % alignof(ChildAllocator);
+    uint32_t bytes = static_cast<uint32_t>(size - pad - sizeof(ChildAllocator));
+    return new(reinterpret_cast<void*>(at + pad)) ChildAllocator(&parent, &FreeIn<PARENT>, mem, bytes);
+  }
+
+  // Gives the region back to the parent. This, and everything allocated
+  // from it or its descendants, is invalid after. Destructors aren't run.
+  void Release() {
+    m_ReleaseFn(m_Parent, m_Region);
+  }
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    static_assert(alignof(T) <= BlockCore::Align, "ChildAllocator blocks aren't aligned enough for this type");
+    static_assert(sizeof(T) < (1u << 31), "Allocation requested is larger than any ChildAllocator.");
+    void* mem = BlockCore::Malloc(Base(), m_Bytes, sizeof(T), LifetimeShort);
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m);
+      BlockCore::Free(Base(), m_Bytes, m);
+    }
+  }
+
+  void* Malloc(size_t size, Lifetime hint = LifetimeShort) {
+    void* mem = size < m_Bytes ? BlockCore::Malloc(Base(), m_Bytes, static_cast<uint32_t>(size), hint) : nullptr;
+    Trace(TraceMalloc, size, 0, mem);
+    return mem;
+  }
+
+  // Pointers from elsewhere are ignored; their header isn't read.
+  void Free(void* m) {
+    if(Owns(m)) {
+      Trace(TraceFree, 0, 0, m);
+      BlockCore::Free(Base(), m_Bytes, m);
+    }
+  }
+
+  BlockStats GetStats() const {
+    return BlockCore::GetStats(Base(), m_Bytes);
+  }
+
+  // Bytes for blocks and their headers, after this header.
+  uint32_t Capacity() const { return m_Bytes; }
+
+  // True if m is inside the region's blocks, past the first header.
+  bool Owns(const void* m) const {
+    return BlockCore::Contains(Base(), m_Bytes, m);
+  }
+
+  ChildAllocator(const ChildAllocator&) = delete;
+  ChildAllocator& operator=(const ChildAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// ChildAllocator Internal
+
+  void* m_Parent;
+  void (*m_ReleaseFn)(void* parent, void* region);
+  void* m_Region;
+  uint32_t m_Bytes;
+
+  ChildAllocator(void* parent, void (*releaseFn)(void*, void*), void* region, uint32_t bytes)
+    : m_Parent(parent), m_ReleaseFn(releaseFn), m_Region(region), m_Bytes(bytes) {
+    BlockCore::Init(Base(), bytes);
+  }
+
+  template<typename PARENT>
+  static void FreeIn(void* parent, void* region) {
+    static_cast<PARENT*>(parent)->Free(region);
+  }
+
+  char* Base() { return reinterpret_cast<char*>(this + 1); }
+  const char* Base() const { return reinterpret_cast<const char*>(this + 1); }
+
+};
+
+////////////////////////////////////////////////////////////////////// PoolAllocator
+
+// COUNT blocks of BLOCK_SIZE bytes, each aligned to ALIGN. Malloc,
+// Free, New and Delete are O(1): free blocks form a list threaded
+// through their first 4 bytes, and blocks never used yet are handed
+// out in order, so construction doesn't touch the buffer.
+//
+//   PoolAllocator<64, 256> Particles;
+//   Particle* p = Particles.New<Particle>();
+//   Particles.Delete(p);
+//
+// A bit per block records which are handed out, so Free ignores a
+// block that's already free, or a pointer that isn't the start of one.
+template<uint32_t BLOCK_SIZE, uint32_t COUNT, uint32_t ALIGN = 16>
+class PoolAllocator : public TraceSink {
+  static_assert(ALIGN && (ALIGN & (ALIGN - 1)) == 0, "PoolAllocator alignment must be a power of two");
+  static_assert(BLOCK_SIZE >= sizeof(uint32_t), "PoolAllocator blocks must be at least 4 bytes");
+  static_assert(BLOCK_SIZE % ALIGN == 0, "PoolAllocator block size must be a multiple of the alignment");
+  static_assert(COUNT > 0, "PoolAllocator needs at least one block");
+  static_assert(uint64_t(BLOCK_SIZE) * COUNT < (1u << 31), "PoolAllocator doesn't support being larger than 2^31");
+public:
+
+  ////////////////////////////////////////////////////////////////////// PoolAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    static_assert(sizeof(T) <= BLOCK_SIZE, "Type is larger than the pool's blocks.");
+    static_assert(alignof(T) <= ALIGN, "Type needs more alignment than the pool's blocks have.");
+    void* mem = InternalMalloc();
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m);
+      InternalFree(static_cast<void*>(m));
+    }
+  }
+
+  // Returns nullptr if size is larger than BLOCK_SIZE or the pool is empty.
+  void* Malloc(size_t size) {
+    void* mem = size <= BLOCK_SIZE ? InternalMalloc() : nullptr;
+    Trace(TraceMalloc, size, 0, mem);
+    return mem;
+  }
+
+  void Free(void* m) {
+    if(IsOut(m)) {
+      Trace(TraceFree, 0, 0, m);
+      InternalFree(m);
+    }
+  }
+
+  bool Owns(const void* m) const {
+    const char* c = static_cast<const char*>(m);
+    return c >= Base() && c < Base() + BLOCK_SIZE * COUNT;
+  }
+
+  // Position of an owned block, 0 to COUNT-1.
+  uint32_t Index(const void* m) const {
+    return static_cast<uint32_t>((static_cast<const char*>(m) - Base()) / BLOCK_SIZE);
+  }
+
+  char* Block(uint32_t index) { return Base() + index * BLOCK_SIZE; }
+
+  // The first block. All COUNT blocks follow it contiguously.
+  char* Base() { return m_Buffer + Padding(); }
+  const char* Base() const { return m_Buffer + Padding(); }
+
+  uint32_t Used() const { return m_Used; }
+  static uint32_t Capacity() { return COUNT; }
+  static uint32_t BlockSize() { return BLOCK_SIZE; }
+
+  PoolAllocator()
+    : m_Free(COUNT)
+    , m_Untouched(0)
+    , m_Used(0) {
+    memset(m_Out, 0, sizeof(m_Out));
+  }
+
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// PoolAllocator Internal
+
+  // alignas on the buffer isn't honoured by operator new before C++17,
+  // so the first aligned byte is found at runtime instead.
+  char m_Buffer[BLOCK_SIZE * COUNT + ALIGN - 1];
+  uint32_t m_Free;      // head of the free list, COUNT when empty
+  uint32_t m_Untouched; // blocks from here on have never been handed out
+  uint32_t m_Used;
+  uint32_t m_Out[(COUNT + 31) / 32]; // a bit per handed out block
+
+  size_t Padding() const {
+    return (ALIGN - reinterpret_cast<uintptr_t>(m_Buffer) % ALIGN) % ALIGN;
+  }
+
+  void* InternalMalloc() {
+    char* b;
+    if(m_Free != COUNT) {
+      b = Block(m_Free);
+      memcpy(&m_Free, b, sizeof(m_Free));
+    } else if(m_Untouched != COUNT) {
+      b = Block(m_Untouched++);
+    } else {
+      return nullptr;
+    }
+    uint32_t index = Index(b);
+    m_Out[index / 32] |= 1u << (index % 32);
+    m_Used++;
+    return b;
+  }
+
+  // True for the start of a block that's handed out.
+  bool IsOut(const void* m) const {
+    if(!Owns(m) || (static_cast<const char*>(m) - Base()) % BLOCK_SIZE) {
+      return false;
+    }
+    uint32_t index = Index(m);
+    return (m_Out[index / 32] >> (index % 32)) & 1;
+  }
+
+  void InternalFree(void* mem) {
+    if(!IsOut(mem)) {
+      return;
+    }
+    uint32_t index = Index(mem);
+    m_Out[index / 32] &= ~(1u << (index % 32));
+    memcpy(Block(index), &m_Free, sizeof(m_Free));
+    m_Free = index;
+    m_Used--;
+  }
+};
+
+////////////////////////////////////////////////////////////////////// RingAllocator
+
+// Ring index: a plain counter, or an atomic one for the SPSC variant.
+template<bool SPSC>
+struct RingIndex {
+  uint32_t V;
+  uint32_t Load() const { return V; }
+  uint32_t Acquire() const { return V; }
+  void Release(uint32_t v) { V = v; }
+};
+
+template<>
+struct RingIndex<true> {
+  std::atomic<uint32_t> V;
+  uint32_t Load() const { return V.load(std::memory_order_relaxed); }
+  uint32_t Acquire() const { return V.load(std::memory_order_acquire); }
+  void Release(uint32_t v) { V.store(v, std::memory_order_release); }
+};
+
+// Variable size records in FIFO order from a circular buffer of SIZE
+// bytes. Every allocation is contiguous: one that doesn't fit before
+// the end of the buffer skips the remainder and starts again at the
+// front (the bip buffer trick), leaving a skip record over the
+// remainder. Malloc and Free are O(1).
+//
+//   RingAllocator<65536> Commands;
+//   void* cmd = Commands.Malloc(100);
+//   Commands.Free(cmd);
+//
+// Records are meant to be freed oldest first. A record freed early
+// is marked and its space comes back once everything older is freed.
+//
+// With SPSC = true (SpscRingAllocator), one thread may Malloc/New
+// while another Free/Deletes, without locks.
+template<uint32_t SIZE, bool SPSC = false>
+class RingAllocator : public TraceSink {
+  static_assert(SIZE >= 8 && (SIZE & (SIZE - 1)) == 0, "RingAllocator size must be a power of two");
+  static_assert(SIZE <= (1u << 30), "RingAllocator doesn't support being larger than 2^30");
+public:
+
+  ////////////////////////////////////////////////////////////////////// RingAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    static_assert(alignof(T) <= sizeof(uint32_t), "RingAllocator records are only 4 byte aligned.");
+    static_assert(sizeof(T) <= SIZE - sizeof(uint32_t), "Allocation requested is larger than the allocator.");
+    void* mem = InternalMalloc(sizeof(T));
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m);
+      InternalFree(static_cast<void*>(m));
+    }
+  }
+
+  // Returns nullptr when there isn't size contiguous bytes free.
+  void* Malloc(size_t size) {
+    void* mem = size <= SIZE - sizeof(uint32_t) ? InternalMalloc(static_cast<uint32_t>(size)) : nullptr;
+    Trace(TraceMalloc, size, 0, mem);
+    return mem;
+  }
+
+  // Pointers from elsewhere are ignored; their header isn't read.
+  void Free(void* m) {
+    if(Owns(m)) {
+      Trace(TraceFree, 0, 0, m);
+      InternalFree(m);
+    }
+  }
+
+  // True if m's header is a record header in the buffer. An empty
+  // record at the very end has its payload one past the buffer.
+  bool Owns(const void* m) const {
+    const char* c = static_cast<const char*>(m);
+    return c >= m_Buffer + sizeof(uint32_t) && c <= m_Buffer + SIZE &&
+           (c - m_Buffer) % sizeof(uint32_t) == 0;
+  }
+
+  // Bytes between the oldest live record and the newest, including
+  // headers, skipped ends and records freed early.
+  uint32_t Used() const { return m_Head.Acquire() - m_Tail.Acquire(); }
+  static uint32_t Capacity() { return SIZE; }
+
+  RingAllocator() : m_TailCache(0) {
+    m_Head.Release(0);
+    m_Tail.Release(0);
+  }
+
+  RingAllocator(const RingAllocator&) = delete;
+  RingAllocator& operator=(const RingAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// RingAllocator Internal
+
+  // A record is a 4 byte header and its payload, rounded up to 4 bytes.
+  // The header holds the record's whole length, so the low bits are
+  // free for flags.
+  enum {
+    FlagFreed = 1,
+    FlagSkip  = 2,
+    FlagMask  = 3
+  };
+
+  // head and tail count bytes forever, wrapping at 2^32. Their
+  // positions in the buffer are the low bits. Only Malloc writes head
+  // and only Free writes tail, which is all SPSC needs. Padding keeps
+  // them on separate cache lines.
+  char m_Buffer[SIZE];
+  RingIndex<SPSC> m_Head;
+  uint32_t m_TailCache; // the producer's last look at tail
+  char m_Pad[64];
+  RingIndex<SPSC> m_Tail;
+
+  uint32_t* At(uint32_t counter) {
+    return reinterpret_cast<uint32_t*>(m_Buffer + (counter & (SIZE - 1)));
+  }
+
+  static uint32_t& Header(void* m) {
+    return *(static_cast<uint32_t*>(m) - 1);
+  }
+
+  // Is there room for bytes more past head? Refreshes the cached tail
+  // only when the stale one says no.
+  bool Fits(uint32_t head, uint32_t bytes) {
+    if(SIZE - (head - m_TailCache) >= bytes) {
+      return true;
+    }
+    m_TailCache = m_Tail.Acquire();
+    return SIZE - (head - m_TailCache) >= bytes;
+  }
+
+  void* InternalMalloc(uint32_t size) {
+    uint32_t bytes = ((size + 3) & ~3u) + sizeof(uint32_t);
+    uint32_t head = m_Head.Load();
+    uint32_t room = SIZE - (head & (SIZE - 1)); // before the end of the buffer
+    uint32_t skip = bytes > room ? room : 0;
+    if(!Fits(head, skip + bytes)) {
+      return nullptr;
+    }
+    if(skip) {
+      *At(head) = skip | FlagSkip | FlagFreed;
+      head += skip;
+    }
+    uint32_t* h = At(head);
+    *h = bytes;
+    m_Head.Release(head + bytes);
+    return h + 1;
+  }
+
+  void InternalFree(void* mem) {
+    if(!Owns(mem)) {
+      return;
+    }
+    Header(mem) |= FlagFreed;
+    // reclaim every freed record from the oldest on.
+    uint32_t tail = m_Tail.Load();
+    uint32_t head = m_Head.Acquire();
+    while(tail != head) {
+      uint32_t header = *At(tail);
+      if(!(header & FlagFreed)) {
+        break;
+      }
+      tail += header & ~FlagMask;
+    }
+    // empty: start over at the front, so the whole buffer is one run.
+    // Not for SPSC, where head belongs to the other thread.
+    if(!SPSC && tail == head) {
+      m_Head.Release(0);
+      m_TailCache = tail = 0;
+    }
+    m_Tail.Release(tail);
+  }
+};
+
+template<uint32_t SIZE>
+using SpscRingAllocator = RingAllocator<SIZE, true>;
+
+////////////////////////////////////////////////////////////////////// LinearAllocator
+
+// Bump allocation from a buffer of SIZE bytes: Malloc and New just
+// advance an offset. Nothing is freed on its own; memory comes back
+// all at once with Reset, or back to a marker with Rewind.
+//
+//   LinearAllocator<65536> Scratch;
+//   LinearAllocator<65536>::Marker m = Scratch.GetMarker();
+//   // ... temporary allocations ...
+//   Scratch.Rewind(m);
+//
+// Free and Delete are accepted so it can stand in for the other
+// allocators (StdAllocator, for one), but only Delete does anything:
+// it runs the destructor.
+//
+// Create is New for objects the arena owns: their destructors run, in
+// reverse order, when Reset, Rewind or the allocator's own destructor
+// drops them. Don't Delete them. Trivially destructible types cost
+// nothing extra; the rest take a 16 byte record in the arena.
+template<uint32_t SIZE>
+class LinearAllocator : public TraceSink {
+  static_assert(SIZE < (1u << 31), "LinearAllocator doesn't support being larger than 2^31");
+public:
+  typedef uint32_t Marker;
+
+  // Malloc's alignment, enough for any fundamental type.
+  static const uint32_t DefaultAlign = 16;
+
+  ////////////////////////////////////////////////////////////////////// LinearAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    static_assert(sizeof(T) <= SIZE, "Allocation requested is larger than the allocator.");
+    void* mem = InternalMalloc(sizeof(T), alignof(T));
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m);
+    }
+  }
+
+  // New, with the destructor run by Reset/Rewind. See above.
+  template<typename T, typename...Args>
+  T* Create(Args...args) {
+    return InternalCreate<T>(typename std::is_trivially_destructible<T>::type(), args...);
+  }
+
+  // align must be a power of two.
+  void* Malloc(size_t size, uint32_t align = DefaultAlign) {
+    void* mem = size <= SIZE ? InternalMalloc(static_cast<uint32_t>(size), align) : nullptr;
+    Trace(TraceMalloc, size, align, mem);
+    return mem;
+  }
+
+  void Free(void* m) {
+    if(m) {
+      Trace(TraceFree, 0, 0, m);
+    }
+  }
+
+  Marker GetMarker() const { return m_Offset; }
+
+  // Drops everything allocated since the marker was taken.
+  void Rewind(Marker marker) {
+    if(marker < m_Offset) {
+      RunCleanups(marker);
+      m_Offset = marker;
+    }
+  }
+
+  void Reset() {
+    RunCleanups(0);
+    m_Offset = 0;
+  }
+
+  uint32_t Used() const { return m_Offset; }
+  static uint32_t Capacity() { return SIZE; }
+
+  bool Owns(const void* m) const {
+    const char* c = static_cast<const char*>(m);
+    return c >= m_Buffer && c < m_Buffer + SIZE;
+  }
+
+  LinearAllocator() : m_Offset(0), m_Cleanups(NoCleanup) {
+  }
+
+  ~LinearAllocator() {
+    RunCleanups(0);
+  }
+
+  LinearAllocator(const LinearAllocator&) = delete;
+  LinearAllocator& operator=(const LinearAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// LinearAllocator Internal
+
+  // One per Created object that needs destroying, allocated right after
+  // it. They form a list from the newest back, by offset.
+  struct Cleanup {
+    void (*Destroy)(void*);
+    uint32_t Object;
+    uint32_t Prev;
+  };
+
+  static const uint32_t NoCleanup = UINT32_MAX;
+
+  char m_Buffer[SIZE];
+  uint32_t m_Offset;
+  uint32_t m_Cleanups; // the newest Cleanup, or NoCleanup
+
+  template<typename T>
+  static void Destroy(void* m) {
+    static_cast<T*>(m)->~T();
+  }
+
+  template<typename T, typename...Args>
+  T* InternalCreate(std::true_type, Args...args) {
+    return New<T>(args...);
+  }
+
+  template<typename T, typename...Args>
+  T* InternalCreate(std::false_type, Args...args) {
+    static_assert(sizeof(T) <= SIZE, "Allocation requested is larger than the allocator.");
+    Marker before = m_Offset;
+    void* mem = InternalMalloc(sizeof(T), alignof(T));
+    Cleanup* c = mem ? static_cast<Cleanup*>(InternalMalloc(sizeof(Cleanup), alignof(Cleanup))) : nullptr;
+    if(!c) {
+      m_Offset = before;
+      mem = nullptr;
+    }
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    if(!mem) {
+      return nullptr;
+    }
+    T* t = new(mem) T(args...);
+    // linked only once constructed, so a throwing constructor leaves
+    // nothing to destroy.
+    c->Destroy = &Destroy<T>;
+    c->Object = static_cast<uint32_t>(static_cast<char*>(mem) - m_Buffer);
+    c->Prev = m_Cleanups;
+    m_Cleanups = static_cast<uint32_t>(reinterpret_cast<char*>(c) - m_Buffer);
+    return t;
+  }
+
+  // Destroys the Created objects at or past marker, newest first.
+  void RunCleanups(Marker marker) {
+    while(m_Cleanups != NoCleanup && m_Cleanups >= marker) {
+      Cleanup* c = reinterpret_cast<Cleanup*>(m_Buffer + m_Cleanups);
+      m_Cleanups = c->Prev;
+      c->Destroy(m_Buffer + c->Object);
+    }
+  }
+
+  void* InternalMalloc(uint32_t size, uint32_t align) {
+    // align the address, not the offset: the buffer itself may only
+    // be as aligned as the object holding it.
+    uintptr_t at = reinterpret_cast<uintptr_t>(m_Buffer) + m_Offset;
+    uint32_t pad = static_cast<uint32_t>((align - at % align) % align);
+    if(size > SIZE - m_Offset || pad > SIZE - m_Offset - size) {
+      return nullptr;
+    }
+    m_Offset += pad + size;
+    return reinterpret_cast<void*>(at + pad);
+  }
+};
+
+////////////////////////////////////////////////////////////////////// FrameAllocator
+
+// N LinearAllocators used in rotation, one per frame. BeginFrame moves
+// to the next and resets it, in O(1), so anything allocated in a frame
+// stays valid for the N-1 frames after it: N = 2 lets the render thread
+// read last frame's data while this frame's is being built.
+//
+//   FrameAllocator<1 << 20> Frames;
+//   // each frame
+//   Frames.BeginFrame();
+//   DrawList* list = Frames.New<DrawList>();
+//
+// BeginFrame resets the recycled arena, so it runs the destructors of
+// objects made there with Create and no others.
+template<uint32_t SIZE, uint32_t N = 2>
+class FrameAllocator {
+  static_assert(N >= 2, "FrameAllocator needs at least two frames");
+public:
+  typedef LinearAllocator<SIZE> Arena;
+
+  template<typename T, typename...Args>
+  T* New(Args...args) { return m_Arenas[m_Current].template New<T>(args...); }
+
+  template<typename T>
+  void Delete(T* m) { m_Arenas[m_Current].Delete(m); }
+
+  // Destroyed when its frame's arena comes round again.
+  template<typename T, typename...Args>
+  T* Create(Args...args) { return m_Arenas[m_Current].template Create<T>(args...); }
+
+  void* Malloc(size_t size, uint32_t align = Arena::DefaultAlign) {
+    return m_Arenas[m_Current].Malloc(size, align);
+  }
+
+  void Free(void* m) { m_Arenas[m_Current].Free(m); }
+
+  // Recycles the arena of the frame N-1 frames ago.
+  void BeginFrame() {
+    m_Current = (m_Current + 1) % N;
+    m_Arenas[m_Current].Reset();
+    m_Frame++;
+  }
+
+  Arena& Current() { return m_Arenas[m_Current]; }
+  uint64_t Frame() const { return m_Frame; }
+
+#if defined(XO_ALLOC_TRACE)
+  void SetTraceRecorder(TraceRecorder* recorder) {
+    for(Arena& a : m_Arenas) {
+      a.SetTraceRecorder(recorder);
+    }
+  }
+#endif
+
+  FrameAllocator() : m_Current(0), m_Frame(0) {}
+
+  FrameAllocator(const FrameAllocator&) = delete;
+  FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+private:
+  Arena m_Arenas[N];
+  uint32_t m_Current;
+  uint64_t m_Frame;
+};
+
+////////////////////////////////////////////////////////////////////// ArenaPool
+
+// Lock for an ArenaPool only used from one thread.
+struct NoLock {
+  void lock() {}
+  void unlock() {}
+};
+
+struct ArenaPoolStats {
+  uint32_t Live;        // arenas in existence, out or idle
+  uint32_t Idle;        // arenas waiting for a Checkout
+  uint32_t PeakOut;     // most checked out at once since the last trim
+  uint32_t PeakUsed;    // most bytes any one checkout used
+  uint64_t Checkouts;
+  uint64_t Cold;        // checkouts that had to construct a new arena
+  uint64_t Refused;     // checkouts that found all MAX out
+};
+
+// Up to MAX arenas recycled between requests, so a request gets an
+// arena whose pages are already faulted in instead of a new one.
+// Checkout hands out the most recently returned arena, whose pages are
+// the likeliest to still be in cache. Return finds it among those
+// checked out, a scan of at most MAX pointers under the lock, and
+// resets it outside the lock. For a LinearAllocator the reset is O(1)
+// plus the destructors of whatever it Created.
+//
+//   ArenaPool<LinearAllocator<1 << 20>, 64, std::mutex> Requests;
+//   // per request
+//   LinearAllocator<1 << 20>* arena = Requests.Checkout();
+//   Reply* reply = arena->Create<Reply>();
+//   Requests.Return(arena);
+//
+// ARENA needs Reset, Used, Capacity and a Malloc(size) that returns
+// nullptr when full (Reserve touches pages through it), as
+// LinearAllocator has. LOCK is anything with lock and unlock:
+// std::mutex for a pool shared between threads. The arenas themselves
+// aren't locked; each is used by one request at a time.
+//
+// Every TrimEvery returns, idle arenas beyond the most that were out at
+// once since the last trim are deleted, so the pool settles at the
+// concurrency it actually sees. PeakUsed is what to size ARENA by: well
+// under Capacity is wasted memory per arena, close to it means some
+// requests are likely running out.
+template<typename ARENA, uint32_t MAX, typename LOCK = NoLock>
+class ArenaPool {
+  static_assert(MAX > 0, "ArenaPool needs at least one arena");
+public:
+  static const uint32_t TrimEvery = 4096;
+
+  ////////////////////////////////////////////////////////////////////// ArenaPool API
+
+  // An empty arena, or nullptr if all MAX are out.
+  ARENA* Checkout() {
+    m_Lock.lock();
+    ARENA* arena = m_IdleCount ? m_Idle[--m_IdleCount] : nullptr;
+    bool create = !arena && m_Live < MAX;
+    if(create) {
+      m_Live++;
+      m_Cold++;
+    } else if(!arena) {
+      m_Refused++;
+    }
+    if(arena) {
+      m_Out[m_OutCount++] = arena;
+    }
+    m_Checkouts++;
+    NotePeakOut();
+    m_Lock.unlock();
+    // the slot is counted already, so construct outside the lock.
+    if(create) {
+      arena = new(std::nothrow) ARENA;
+      m_Lock.lock();
+      if(arena) {
+        m_Out[m_OutCount++] = arena;
+      } else {
+        m_Live--;
+      }
+      m_Lock.unlock();
+    }
+    return arena;
+  }
+
+  // Resets arena, running its Created objects' destructors, and keeps
+  // it for the next Checkout. An arena this pool didn't check out, or
+  // one already returned, is left alone.
+  void Return(ARENA* arena) {
+    m_Lock.lock();
+    bool owned = InternalCheckIn(arena);
+    m_Lock.unlock();
+    if(!owned) {
+      return;
+    }
+    uint32_t used = arena->Used();
+    arena->Reset();
+    m_Lock.lock();
+    if(used > m_PeakUsed) {
+      m_PeakUsed = used;
+    }
+    InternalPushIdle(arena);
+    if(++m_Returns % TrimEvery == 0) {
+      InternalTrim();
+    }
+    m_Lock.unlock();
+  }
+
+  // Makes count arenas live and touches every page of the new ones, so
+  // the first requests don't pay for the page faults.
+  void Reserve(uint32_t count) {
+    for(;;) {
+      m_Lock.lock();
+      bool create = m_Live < count && m_Live < MAX;
+      if(create) {
+        m_Live++;
+      }
+      m_Lock.unlock();
+      if(!create) {
+        return;
+      }
+      ARENA* arena = new(std::nothrow) ARENA;
+      if(arena) {
+        while(char* page = static_cast<char*>(arena->Malloc(4096))) {
+          *page = 0;
+        }
+        arena->Reset();
+      }
+      m_Lock.lock();
+      if(arena) {
+        InternalPushIdle(arena);
+      } else {
+        m_Live--;
+      }
+      m_Lock.unlock();
+      if(!arena) {
+        return;
+      }
+    }
+  }
+
+  // Deletes idle arenas beyond the most out at once since the last
+  // trim. Return does this every TrimEvery calls.
+  void Trim() {
+    m_Lock.lock();
+    InternalTrim();
+    m_Lock.unlock();
+  }
+
+  ArenaPoolStats GetStats() {
+    m_Lock.lock();
+    ArenaPoolStats stats;
+    stats.Live = m_Live;
+    stats.Idle = m_IdleCount;
+    stats.PeakOut = m_PeakOut;
+    stats.PeakUsed = m_PeakUsed;
+    stats.Checkouts = m_Checkouts;
+    stats.Cold = m_Cold;
+    stats.Refused = m_Refused;
+    m_Lock.unlock();
+    return stats;
+  }
+
+  static uint32_t ArenaCapacity() { return ARENA::Capacity(); }
+
+  ArenaPool()
+    : m_IdleCount(0), m_OutCount(0), m_Live(0), m_PeakOut(0), m_PeakUsed(0), m_Returns(0),
+      m_Checkouts(0), m_Cold(0), m_Refused(0) {}
+
+  // Every arena must have been returned.
+  ~ArenaPool() {
+    while(m_IdleCount) {
+      delete m_Idle[--m_IdleCount];
+    }
+  }
+
+  ArenaPool(const ArenaPool&) = delete;
+  ArenaPool& operator=(const ArenaPool&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// ArenaPool Internal
+
+  LOCK m_Lock;
+  ARENA* m_Idle[MAX]; // a stack: the top was returned last
+  uint32_t m_IdleCount;
+  ARENA* m_Out[MAX];  // checked out, in no order
+  uint32_t m_OutCount;
+  uint32_t m_Live;
+  uint32_t m_PeakOut;
+  uint32_t m_PeakUsed;
+  uint32_t m_Returns;
+  uint64_t m_Checkouts;
+  uint64_t m_Cold;
+  uint64_t m_Refused;
+
+  void NotePeakOut() {
+    uint32_t out = m_Live - m_IdleCount;
+    if(out > m_PeakOut) {
+      m_PeakOut = out;
+    }
+  }
+
+  // Called locked. Takes arena off the checked out list; false if it
+  // isn't there. A scan, but of at most MAX pointers.
+  bool InternalCheckIn(ARENA* arena) {
+    for(uint32_t i = 0; i < m_OutCount; ++i) {
+      if(m_Out[i] == arena) {
+        m_Out[i] = m_Out[--m_OutCount];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Called locked. Every arena is idle, out or being made, and there
+  // are at most MAX of them, so the stack can't be full. Should it be,
+  // the arena is deleted rather than written past the end.
+  void InternalPushIdle(ARENA* arena) {
+    if(m_IdleCount < MAX) {
+      m_Idle[m_IdleCount++] = arena;
+    } else {
+      delete arena;
+      m_Live--;
+    }
+  }
+
+  // Called locked. Deleting under the lock stalls other threads, but
+  // only once per TrimEvery returns, and only when the pool shrinks.
+  void InternalTrim() {
+    while(m_IdleCount && m_Live > m_PeakOut) {
+      delete m_Idle[--m_IdleCount];
+      m_Live--;
+    }
+    m_PeakOut = 0;
+    NotePeakOut();
+  }
+};
+
+////////////////////////////////////////////////////////////////////// DoubleStackAllocator
+
+enum StackEnd {
+  StackLow,  // grows up from the start of the buffer
+  StackHigh  // grows down from the end
+};
+
+// Two LinearAllocator-style stacks sharing one buffer of SIZE bytes,
+// growing towards each other, so two kinds of data split one budget
+// without ever interleaving. Say, level data that lives until the
+// level unloads from the low end, and load time scratch from the high
+// end, rewound when loading is done:
+//
+//   DoubleStackAllocator<1 << 24> Level;
+//   Mesh* mesh = Level.New<Mesh>();                  // low end
+//   DoubleStackAllocator<1 << 24>::Marker m = Level.GetMarker(StackHigh);
+//   char* temp = static_cast<char*>(Level.Malloc(4096, StackHigh));
+//   Level.Rewind(StackHigh, m);
+//
+// Each end has its own markers; rewinding one never touches the other.
+// As with LinearAllocator, Free does nothing and Delete only runs the
+// destructor.
+template<uint32_t SIZE>
+class DoubleStackAllocator : public TraceSink {
+  static_assert(SIZE < (1u << 31), "DoubleStackAllocator doesn't support being larger than 2^31");
+public:
+  typedef uint32_t Marker;
+
+  static const uint32_t DefaultAlign = 16;
+
+  ////////////////////////////////////////////////////////////////////// DoubleStackAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    return NewAt<T>(StackLow, args...);
+  }
+
+  template<typename T, typename...Args>
+  T* NewAt(StackEnd end, Args...args) {
+    static_assert(sizeof(T) <= SIZE, "Allocation requested is larger than the allocator.");
+    void* mem = InternalMalloc(sizeof(T), alignof(T), end);
+    Trace(TraceNew, sizeof(T), alignof(T), mem);
+    return mem ? new(mem) T(args...) : nullptr;
+  }
+
+  template<typename T>
+  void Delete(T* m) {
+    if(m) {
+      m->~T();
+      Trace(TraceDelete, sizeof(T), alignof(T), m);
+    }
+  }
+
+  // align must be a power of two.
+  void* Malloc(size_t size, StackEnd end = StackLow, uint32_t align = DefaultAlign) {
+    void* mem = size <= SIZE ? InternalMalloc(static_cast<uint32_t>(size), align, end) : nullptr;
+    Trace(TraceMalloc, size, align, mem);
+    return mem;
+  }
+
+  void Free(void* m) {
+    if(m) {
+      Trace(TraceFree, 0, 0, m);
+    }
+  }
+
+  Marker GetMarker(StackEnd end) const {
+    return end == StackLow ? m_Low : m_High;
+  }
+
+  // Drops everything allocated at that end since the marker was taken.
+  void Rewind(StackEnd end, Marker marker) {
+    if(end == StackLow && marker < m_Low) {
+      m_Low = marker;
+    } else if(end == StackHigh && marker > m_High) {
+      m_High = marker;
+    }
+  }
+
+  void Reset(StackEnd end) {
+    Rewind(end, end == StackLow ? 0 : SIZE);
+  }
+
+  void Reset() {
+    m_Low = 0;
+    m_High = SIZE;
+  }
+
+  uint32_t Used(StackEnd end) const { return end == StackLow ? m_Low : SIZE - m_High; }
+  uint32_t Available() const { return m_High - m_Low; }
+  static uint32_t Capacity() { return SIZE; }
+
+  DoubleStackAllocator() : m_Low(0), m_High(SIZE) {
+  }
+
+  DoubleStackAllocator(const DoubleStackAllocator&) = delete;
+  DoubleStackAllocator& operator=(const DoubleStackAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// DoubleStackAllocator Internal
+
+  char m_Buffer[SIZE];
+  uint32_t m_Low;  // offset of the first byte not in the low stack
+  uint32_t m_High; // offset of the first byte in the high stack
+
+  void* InternalMalloc(uint32_t size, uint32_t align, StackEnd end) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(m_Buffer);
+    uint32_t room = m_High - m_Low;
+    if(end == StackLow) {
+      uintptr_t at = base + m_Low;
+      uint32_t pad = static_cast<uint32_t>((align - at % align) % align);
+      if(size > room || pad > room - size) {
+        return nullptr;
+      }
+      m_Low += pad + size;
+      return reinterpret_cast<void*>(at + pad);
+    }
+    uintptr_t top = base + m_High;
+    if(size > room) {
+      return nullptr;
+    }
+    uintptr_t at = (top - size) & ~uintptr_t(align - 1);
+    if(at < base + m_Low) {
+      return nullptr;
+    }
+    m_High = static_cast<uint32_t>(at - base);
+    return reinterpret_cast<void*>(at);
+  }
+};
+
+////////////////////////////////////////////////////////////////////// GenerationalAllocator
+
+// A GenerationalAllocator object that follows it through promotion.
+// Index 0 is null. Gen is the slot's generation when the handle was
+// made; once the object is deleted and the slot reused, the old handle
+// no longer matches and resolves to nothing.
+template<typename T>
+class Handle {
+public:
+  Handle() : m_Index(0), m_Gen(0) {}
+  Handle(uint32_t index, uint32_t gen) : m_Index(index), m_Gen(gen) {}
+
+  uint32_t Index() const { return m_Index; }
+  uint32_t Gen() const { return m_Gen; }
+  explicit operator bool() const { return m_Index != 0; }
+
+  bool operator==(const Handle& o) const { return m_Index == o.m_Index && m_Gen == o.m_Gen; }
+  bool operator!=(const Handle& o) const { return !(*this == o); }
+
+private:
+  uint32_t m_Index;
+  uint32_t m_Gen;
+};
+
+// Two generations: objects are bump allocated in a nursery
+// (LinearAllocator<NURSERY>), and the few that outlive it are moved into
+// a tenured BlockAllocator<TENURED, CLASSES>. Collect resets the
+// nursery in O(1), so objects that die young never touch the tenured
+// block list, and it only sees the long lived ones, placed from its
+// end with LifetimeLong.
+//
+//   auto* Heap = new GenerationalAllocator<1 << 20, 1 << 24>;
+//   Message* m = Heap->New<Message>();         // nursery
+//   Session* s = Heap->Promote(Heap->New<Session>()); // tenured now
+//   Handle<Peer> peer = Heap->NewHandle<Peer>();
+//   Heap->Collect(); // m is gone, Heap->Get(peer) is tenured
+//
+// A survivor is moved either explicitly, by Promote, or through a
+// handle: Collect promotes every object with a live handle before the
+// reset and updates the handle. Promote move constructs the object in
+// the tenured space and destroys the old one. Its handle, if it has
+// one, is updated too, but any other pointer to it is stale; hold
+// handles when there are other pointers. Deleting or freeing an object
+// by pointer frees its handle as well.
+//
+// New returns nullptr once the nursery is full; Collect and try again.
+// Nursery objects that aren't promoted aren't destroyed, as with
+// LinearAllocator::New. HANDLES is how many handles can be live at once.
+// Each is a slot holding the object's address and a promote function
+// for its type, so Collect costs the survivors, not the garbage.
+template<uint32_t NURSERY, uint32_t TENURED, uint32_t HANDLES = 1024, typename CLASSES = SizeClasses<> >
+class GenerationalAllocator {
+public:
+  typedef LinearAllocator<NURSERY> Nursery;
+  typedef BlockAllocator<TENURED, CLASSES> Tenured;
+
+  ////////////////////////////////////////////////////////////////////// GenerationalAllocator API
+
+  template<typename T, typename...Args>
+  T* New(Args...args) {
+    return m_Nursery.template New<T>(args...);
+  }
+
+  // Works on either generation. If m has a handle, that's freed too.
+  template<typename T>
+  void Delete(T* m) {
+    ForgetHandle(m);
+    if(m_Nursery.Owns(m)) {
+      m_Nursery.Delete(m);
+    } else {
+      m_Tenured.Delete(m);
+    }
+  }
+
+  void* Malloc(size_t size) {
+    return m_Nursery.Malloc(size);
+  }
+
+  // Nursery memory only comes back at Collect. As Delete, m's handle
+  // is freed too.
+  void Free(void* m) {
+    ForgetHandle(m);
+    if(m_Nursery.Owns(m)) {
+      m_Nursery.Free(m);
+    } else {
+      m_Tenured.Free(m);
+    }
+  }
+
+  // Moves m into the tenured space and returns its new address, or
+  // returns m if it's tenured already. nullptr if the tenured space is
+  // full, in which case m is still in the nursery. If m has a handle,
+  // the handle follows it.
+  template<typename T>
+  T* Promote(T* m) {
+    if(!m || !m_Nursery.Owns(m)) {
+      return m;
+    }
+    T* moved = InternalPromote(m);
+    if(moved) {
+      uint32_t slot = SlotOf(m);
+      if(slot != NoSlot) {
+        Repoint(slot, moved);
+      }
+    }
+    return moved;
+  }
+
+  // New, returning a handle that Collect keeps pointing at the object.
+  // A null handle if the nursery or the handle table is full.
+  template<typename T, typename...Args>
+  Handle<T> NewHandle(Args...args) {
+    if(m_FreeSlot == NoSlot && m_SlotsUsed == HANDLES) {
+      return Handle<T>();
+    }
+    T* m = New<T>(args...);
+    if(!m) {
+      return Handle<T>();
+    }
+    uint32_t index = m_FreeSlot;
+    if(index != NoSlot) {
+      m_FreeSlot = m_Slots[index].NextFree;
+    } else {
+      index = m_SlotsUsed++;
+      m_Slots[index].Gen = 0;
+    }
+    m_Slots[index].Object = m;
+    m_Slots[index].Move = &MoveSlot<T>;
+    IndexAdd(index);
+    return Handle<T>(index + 1, m_Slots[index].Gen);
+  }
+
+  // nullptr for a null handle, or one whose object was deleted.
+  template<typename T>
+  T* Get(Handle<T> h) const {
+    const Slot* slot = FindSlot(h.Index(), h.Gen());
+    return slot ? static_cast<T*>(slot->Object) : nullptr;
+  }
+
+  // Deletes the object and frees its handle. A stale handle is ignored.
+  template<typename T>
+  void Delete(Handle<T> h) {
+    if(const Slot* slot = FindSlot(h.Index(), h.Gen())) {
+      T* m = static_cast<T*>(slot->Object);
+      ReleaseSlot(h.Index() - 1);
+      Delete(m);
+    }
+  }
+
+  // Promotes every nursery object with a live handle, then resets the
+  // nursery. Anything else allocated there is gone. Returns false,
+  // without resetting, if the tenured space ran out; the handles
+  // promoted so far stay promoted.
+  bool Collect() {
+    for(uint32_t i = 0; i < m_SlotsUsed; ++i) {
+      Slot& slot = m_Slots[i];
+      if(slot.Move && m_Nursery.Owns(slot.Object)) {
+        void* moved = slot.Move(*this, slot.Object);
+        if(!moved) {
+          return false;
+        }
+        Repoint(i, moved);
+      }
+    }
+    m_Nursery.Reset();
+    m_Collections++;
+    return true;
+  }
+
+  Nursery& GetNursery() { return m_Nursery; }
+  Tenured& GetTenured() { return m_Tenured; }
+
+  uint64_t Collections() const { return m_Collections; }
+  uint64_t Promoted() const { return m_Promoted; }
+  uint64_t PromotedBytes() const { return m_PromotedBytes; }
+
+#if defined(XO_ALLOC_TRACE)
+  void SetTraceRecorder(TraceRecorder* recorder) {
+    m_Nursery.SetTraceRecorder(recorder);
+    m_Tenured.SetTraceRecorder(recorder);
+  }
+#endif
+
+  GenerationalAllocator()
+    : m_SlotsUsed(0), m_FreeSlot(NoSlot), m_Collections(0), m_Promoted(0), m_PromotedBytes(0) {
+    memset(m_Index, 0, sizeof(m_Index));
+  }
+
+  GenerationalAllocator(const GenerationalAllocator&) = delete;
+  GenerationalAllocator& operator=(const GenerationalAllocator&) = delete;
+
+private:
+  ////////////////////////////////////////////////////////////////////// GenerationalAllocator Internal
+
+  // A handle's object, and how to promote it without knowing its type.
+  // Free slots have no Move and are chained through NextFree. Gen
+  // counts the times the slot was freed.
+  struct Slot {
+    void* Object;
+    void* (*Move)(GenerationalAllocator&, void*);
+    uint32_t NextFree;
+    uint32_t Gen;
+  };
+
+  static const uint32_t NoSlot = UINT32_MAX;
+
+  static constexpr uint32_t PowerOfTwoAtLeast(uint32_t n, uint32_t p = 1) {
+    return p >= n ? p : PowerOfTwoAtLeast(n, p * 2);
+  }
+
+  // m_Index is never more than half full, so probes stay short and
+  // always reach an empty entry.
+  static const uint32_t IndexSize = PowerOfTwoAtLeast(2 * HANDLES);
+
+  Nursery m_Nursery;
+  Tenured m_Tenured;
+  Slot m_Slots[HANDLES];
+  uint32_t m_Index[IndexSize]; // slot + 1 by object address; 0 is empty
+  uint32_t m_SlotsUsed; // slots ever handed out; none past this is live
+  uint32_t m_FreeSlot;
+  uint64_t m_Collections;
+  uint64_t m_Promoted;
+  uint64_t m_PromotedBytes;
+
+  // Tenured blocks are aligned to BlockCore::Align, so T can't ask
+  // for more.
+  template<typename T>
+  T* InternalPromote(T* m) {
+    static_assert(alignof(T) <= BlockCore::Align, "Tenured blocks aren't aligned enough for this type");
+    void* mem = m_Tenured.Malloc(sizeof(T), LifetimeLong);
+    if(!mem) {
+      return nullptr;
+    }
+    T* moved = new(mem) T(std::move(*m));
+    m->~T();
+    m_Promoted++;
+    m_PromotedBytes += sizeof(T);
+    return moved;
+  }
+
+  // Collect repoints the slot itself, so this skips Promote's search.
+  // The live slot a handle with this index (1 based) and gen names,
+  // or nullptr.
+  const Slot* FindSlot(uint32_t index, uint32_t gen) const {
+    if(index == 0 || index > m_SlotsUsed) {
+      return nullptr;
+    }
+    const Slot& slot = m_Slots[index - 1];
+    return slot.Move && slot.Gen == gen ? &slot : nullptr;
+  }
+
+  void ReleaseSlot(uint32_t i) {
+    Slot& slot = m_Slots[i];
+    IndexRemove(slot.Object);
+    slot.Object = nullptr;
+    slot.Move = nullptr;
+    slot.Gen++;
+    slot.NextFree = m_FreeSlot;
+    m_FreeSlot = i;
+  }
+
+  void ForgetHandle(const void* m) {
+    uint32_t slot = m ? SlotOf(m) : NoSlot;
+    if(slot != NoSlot) {
+      ReleaseSlot(slot);
+    }
+  }
+
+  void Repoint(uint32_t i, void* moved) {
+    IndexRemove(m_Slots[i].Object);
+    m_Slots[i].Object = moved;
+    IndexAdd(i);
+  }
+
+  // m_Index: open addressing with linear probing on the object's
+  // address, so finding an object's handle is O(1), not a slot scan.
+
+  static uint32_t IndexHome(const void* m) {
+    return static_cast<uint32_t>((reinterpret_cast<uintptr_t>(m) >> 4) * 2654435761u) & (IndexSize - 1);
+  }
+
+  static uint32_t IndexNext(uint32_t i) {
+    return (i + 1) & (IndexSize - 1);
+  }
+
+  // m's slot, or NoSlot if it has no handle.
+  uint32_t SlotOf(const void* m) const {
+    for(uint32_t i = IndexHome(m); m_Index[i]; i = IndexNext(i)) {
+      if(m_Slots[m_Index[i] - 1].Object == m) {
+        return m_Index[i] - 1;
+      }
+    }
+    return NoSlot;
+  }
+
+  void IndexAdd(uint32_t slot) {
+    uint32_t i = IndexHome(m_Slots[slot].Object);
+    while(m_Index[i]) {
+      i = IndexNext(i);
+    }
+    m_Index[i] = slot + 1;
+  }
+
+  // Empties m's entry, then moves later entries of the run back into
+  // the hole where their probe would still find them.
+  void IndexRemove(const void* m) {
+    uint32_t i = IndexHome(m);
+    for(; m_Index[i]; i = IndexNext(i)) {
+      if(m_Slots[m_Index[i] - 1].Object == m) {
+        break;
+      }
+    }
+    if(!m_Index[i]) {
+      return;
+    }
+    for(uint32_t j = IndexNext(i); m_Index[j]; j = IndexNext(j)) {
+      uint32_t home = IndexHome(m_Slots[m_Index[j] - 1].Object);
+      if(((j - home) & (IndexSize - 1)) >= ((j - i) & (IndexSize - 1))) {
+        m_Index[i] = m_Index[j];
+        i = j;
+      }
+    }
+    m_Index[i] = 0;
+  }
+
+  template<typename T>
+  static void* MoveSlot(GenerationalAllocator& gen, void* m) {
+    return gen.InternalPromote(static_cast<T*>(m));
+  }
+};
+
+////////////////////////////////////////////////////////////////////// StdAllocator
+
+// Lets standard containers allocate from any xo allocator with
+// Malloc/Free. The container only holds a pointer; the allocator
+// must outlive it. Malloc must align like malloc does, to
+// max_align_t: BlockAllocator, ChildAllocator, LinearAllocator and a
+// PoolAllocator with the default ALIGN do. RingAllocator doesn't.
+//
+//   xo::BlockAllocator<65536> Arena;
+//   typedef xo::StdAllocator<int, xo::BlockAllocator<65536> > IntAlloc;
+//   std::vector<int, IntAlloc> v{IntAlloc(Arena)};
+template<typename T, typename ALLOC>
+class StdAllocator {
+  static_assert(alignof(T) <= alignof(std::max_align_t), "StdAllocator can't align over-aligned types");
+public:
+  typedef T value_type;
+
+  template<typename U>
+  struct rebind { typedef StdAllocator<U, ALLOC> other; };
+
+  explicit StdAllocator(ALLOC& a) : m_Alloc(&a) {}
+
+  template<typename U>
+  StdAllocator(const StdAllocator<U, ALLOC>& other) : m_Alloc(other.Allocator()) {}
+
+  T* allocate(size_t n) {
+    void* mem = m_Alloc->Malloc(n * sizeof(T));
+    if(!mem) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(mem);
+  }
+
+  void deallocate(T* m, size_t) {
+    m_Alloc->Free(m);
+  }
+
+  ALLOC* Allocator() const { return m_Alloc; }
+
+private:
+  ALLOC* m_Alloc;
+};
+
+template<typename T, typename U, typename ALLOC>
+bool operator==(const StdAllocator<T, ALLOC>& a, const StdAllocator<U, ALLOC>& b) {
+  return a.Allocator() == b.Allocator();
+}
+
+template<typename T, typename U, typename ALLOC>
+bool operator!=(const StdAllocator<T, ALLOC>& a, const StdAllocator<U, ALLOC>& b) {
+  return a.Allocator() != b.Allocator();
+}
 
 XO_NAMESPACE_END
 